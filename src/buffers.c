@@ -285,7 +285,7 @@ static bool jdb_passthrough(const char *s)
 		"demin", "demin+", "demin-",
 		"jsbg", "jsbg+", "jsbg-",
 		"e+", "e-", "eret",
-		"bflist", "bglist", "hist", "help", 0
+		"bflist", "bglist", "hist", "help", "prof", 0
 	};
 	int i;
 	if (s[0] == '!')
@@ -496,6 +496,9 @@ thus the call to ircReadlineControl().
 		if (rc == 0) {	/* timeout */
 			inInput = false;
 			runTimer();
+// not while you are entering text, that buffer could be the one to change
+			if (!textEntry)
+				imapIdlePoll();
 			inInput = true;
 			intFlag = false;
 
@@ -1006,8 +1009,10 @@ static void freeWindow(Window *w)
 	nzFree(w->referrer);
 	nzFree(w->baseDirName);
 	nzFree(w->mail_raw);
+	mailSpillFree(w);
 // only cleanup the curl handle on imapmode 1, if you try it again on 2 it will blow up.
 	if(w->imapMode1 && w->imap_h) imapCleanupInBackground(w->imap_h);
+	if(w->imapMode2) imapIdleStop(w);
 	if(w->irciMode) {
 		Window *w2 = sessionList[w->ircOther].lw;
 // w2 should always be there
@@ -1962,7 +1967,9 @@ uchar prebrowse, const Tag *gotag)
 		g.thisfile = fromthis;
 		g.custom_h = orig_head;
 		g.cf = cf;
-		rc = httpConnect(&g);
+// frameExpand may have fetched this frame already
+		if (!(fromframe && preloadClaim(&g, &rc)))
+			rc = httpConnect(&g);
 		serverData = g.buffer;
 		serverDataLen = g.length;
 		if (!rc)
@@ -4902,6 +4909,9 @@ test_false:
 		return true;
 	}
 
+	if(cw->imapMode2 && stringEqual(line, "idle"))
+		return imapIdle();
+
 	if(cw->imapMode1 && stringEqual(line, "imask")) {
 		struct MACCOUNT *a = accounts + cw->imap_n - 1;
 		if(!a->maskon) { setError(MSG_NoMask); return false; }
@@ -5742,6 +5752,43 @@ et_go:
 		return true;
 	}
 
+	if (stringEqual(line, "prof"))
+		return profCommand(0);
+	if (!strncmp(line, "prof ", 5) && line[5])
+		return profCommand(line + 5);
+
+	if (!strncmp(line, "mfind ", 6) && line[6]) {
+		char *a;
+		int a_l;
+		Window *w;
+		cmd = 'e';
+		if (!cxQuit(context, 0))
+			return false;
+		if (!(a = mailSearch(line + 6, &a_l)))
+			return false;
+		undoCompare();
+		cw->undoable = cw->changeMode = false;
+		undoSpecialClear();
+		w = createWindow();
+		w->sno = context;
+		w->prev = cw;
+		cw = w;
+		selfFrame();
+		cs->lw = w;
+		rc = addTextToBuffer((pst) a, a_l, 0, false);
+		nzFree(a);
+		cw->changeMode = false;
+		debugPrint(1, "%d", a_l);
+		return rc;
+	}
+
+	if (!strncmp(line, "mindex ", 7) && line[7]) {
+		const char *file = line + 7;
+		if (!envFile(file, &file))
+			return false;
+		return mailIndexFile(file);
+	}
+
 	if (stringEqual(line, "bflist") || !strncmp(line, "bflist/", 7) || !strncmp(line, "bflist?", 7)) {
 		const char c = line[6];
 		const char *s = line + 7;
@@ -8574,7 +8621,8 @@ rebrowse:
 // for some code that is coming up.
 			serverData = emptyString;
 		} else {
-			bool save_pg;
+			bool save_pg, prof;
+			int pn;
 
 /*********************************************************************
 Before we set the new file name, and before we call up the next web page,
@@ -8597,9 +8645,17 @@ we have to make sure it has a protocol. Every url needs a protocol.
 // emode suppresses plugins, as well as browsing
 			save_pg = pluginsOn;
 			if (emode) pluginsOn = false;
+// start a page load profile if we are going to browse this
+			prof = (cmd == 'b');
+			if (prof) {
+				profReset(line, true);
+				pn = profBegin("fetch");
+			}
 			j = readFile(line, (cmd != 'r'), 0,
 				     thisfile, 0, prebrowse,
 			(icmd == 'g' ? gotag : 0));
+			if (prof)
+				profEnd(pn, line);
 			pluginsOn = save_pg;
 		}
 		w->undoable = w->changeMode = false;
@@ -0,0 +1,307 @@
+/*********************************************************************
+codecbench: time the base64 and quoted printable codecs in format.c
+against the byte at a time versions they replaced, and check that
+both give the same answers.
+usage: codecbench [megabytes]
+The data is random bytes for base64, and mostly text for qp,
+as you would find in an attachment and in the body of a message.
+*********************************************************************/
+
+#include "eb.h"
+
+#include <time.h>
+
+// stubs needed by other edbrowse functions that we are pulling in.
+int context; // edbrowse context, not js
+struct ebWindow *cw;
+struct ebSession sessionList[3], *cs;
+int maxSession = 3;
+volatile bool intFlag;
+bool inInput;
+bool cxCompare(int cx) { return false; }
+bool cxActive(int cx, bool error) { return false; }
+bool cxQuit(int cx, int action) { return true; }
+void cxSwitch(int cx, bool interactive) {}
+bool browseCurrentBuffer(const char *suffix, bool present) { return false; }
+int sideBuffer(int cx, const char *text, int textlen, const char *bufname){ return 0; }
+void undoSpecialClear(void){}
+pst fetchLine(int n, int show){ return (uchar*)emptyString; }
+void delText(int start, int end) {}
+void addToMap(int nlines, int destl){}
+bool addTextToBuffer(const uchar *inbuf, int length, int destl, bool showtrail) { return true; }
+void printDot(void){}
+int tableType(const Tag *t) { return 0; }
+void eeCheck(void){}
+void ebClose(int n) { exit(n); }
+struct MACCOUNT accounts[MAXACCOUNT];
+int maxAccount;		/* how many email accounts specified */
+char *emojiFile;
+void preFormatCheck(int tagno, bool * pretag, bool * slash) {}
+bool isDataURI(const char *u){ return false; }
+void unpercentString(char *s) {}
+
+// the old codecs, a character at a time
+
+static const char ref_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static char *ref_base64Encode(const char *inbuf, int inlen, bool lines)
+{
+	char *out, *outstr;
+	uchar *in = (uchar *) inbuf;
+	int colno;
+	int outlen = ((inlen / 3) + 1) * 4;
+	++outlen;
+	if (lines)
+		outlen += ((inlen / 54) + 1) * 2;
+	outstr = out = allocMem(outlen);
+	colno = 0;
+	while (inlen >= 3) {
+		*out++ = ref_chars[(int)(*in >> 2)];
+		*out++ = ref_chars[(int)((*in << 4 | *(in + 1) >> 4) & 63)];
+		*out++ = ref_chars[(int)((*(in + 1) << 2 | *(in + 2) >> 6) & 63)];
+		*out++ = ref_chars[(int)(*(in + 2) & 63)];
+		inlen -= 3;
+		in += 3;
+		if (!lines)
+			continue;
+		colno += 4;
+		if (colno < 72)
+			continue;
+		*out++ = '\r', *out++ = '\n';
+		colno = 0;
+	}
+	if (inlen == 1) {
+		*out++ = ref_chars[(int)(*in >> 2)];
+		*out++ = ref_chars[(int)(*in << 4 & 63)];
+		*out++ = '=';
+		*out++ = '=';
+		colno += 4;
+	}
+	if (inlen == 2) {
+		*out++ = ref_chars[(int)(*in >> 2)];
+		*out++ = ref_chars[(int)((*in << 4 | *(in + 1) >> 4) & 63)];
+		*out++ = ref_chars[(int)((*(in + 1) << 2) & 63)];
+		*out++ = '=';
+		colno += 4;
+	}
+	if (lines && colno)
+		*out++ = '\r', *out++ = '\n';
+	*out = 0;
+	return outstr;
+}
+
+static uchar ref_base64Bits(char c)
+{
+	if (isupperByte(c))
+		return c - 'A';
+	if (islowerByte(c))
+		return c - ('a' - 26);
+	if (isdigitByte(c))
+		return c - ('0' - 52);
+	if (c == '+')
+		return 62;
+	if (c == '/')
+		return 63;
+	return 64;
+}
+
+static int ref_base64Decode(char *start, char **end)
+{
+	char *b64_end = *end;
+	uchar val, leftover = 0, mod;
+	bool equals;
+	int ret = GOOD_BASE64_DECODE;
+	char c, *q, *r;
+	mod = 0;
+	equals = false;
+	for (q = r = start; q < b64_end; ++q) {
+		c = *q;
+		if (isspaceByte(c))
+			continue;
+		if (equals) {
+			if (c == '=')
+				continue;
+			ret = EXTRA_CHARS_BASE64_DECODE;
+			break;
+		}
+		if (c == '=') {
+			equals = true;
+			continue;
+		}
+		val = ref_base64Bits(c);
+		if (val & 64) {
+			ret = BAD_BASE64_DECODE;
+			break;
+		}
+		if (mod == 0) {
+			leftover = val << 2;
+		} else if (mod == 1) {
+			*r++ = (leftover | (val >> 4));
+			leftover = val << 4;
+		} else if (mod == 2) {
+			*r++ = (leftover | (val >> 2));
+			leftover = val << 6;
+		} else {
+			*r++ = (leftover | val);
+		}
+		++mod;
+		mod &= 3;
+	}
+	*end = r;
+	return ret;
+}
+
+static char *ref_qpDecode(char *start, char *end)
+{
+	char c, d, *q, *r;
+	for (q = r = start; q < end; ++q) {
+		c = *q;
+		if (c != '=') { *r++ = c; continue; }
+		c = *++q;
+		if (c == '\n')
+			continue;
+		d = q[1];
+		if (isxdigit(c) && isxdigit(d)) {
+			d = fromHex(c, d);
+			if (d == 0)
+				d = ' ';
+			*r++ = d;
+			++q;
+			continue;
+		}
+		--q;
+		*r++ = '=';
+	}
+	return r;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int failures;
+static void check(const char *what, bool ok)
+{
+	if (ok)
+		return;
+	printf("%s: results differ\n", what);
+	++failures;
+}
+
+static void report(const char *what, double told, double tnew, int mb)
+{
+	printf("%-18s %8.1f ms %8.1f ms %6.2fx %8.1f MB/s\n",
+	       what, told, tnew, (tnew > 0 ? told / tnew : 0),
+	       (tnew > 0 ? mb * 1000.0 / tnew : 0));
+}
+
+// edge cases: pads, white space, bad digits, stuff after the pad
+static const char *const b64cases[] = {
+	"", "QQ==", "QUI=", "QUJD", "QU JD\r\n", "QUJD=", "QQ==QQ",
+	"QUJ", "QU*D", "QUJDRA==\n", "====", "Q", "QUJDRE\nVG", 0
+};
+
+#define ROUNDS 3
+
+int main(int argc, char **argv)
+{
+	int mb = 16, n, j, k, l1, l2, rc1, rc2;
+	char *data, *e1, *e2, *c1, *c2, *q1, *q2, *end1, *end2;
+	double t, t1, t2;
+
+	if (argc > 1)
+		mb = atoi(argv[1]);
+	if (mb <= 0 || mb > 1024) {
+		puts("usage: codecbench [megabytes]");
+		return 1;
+	}
+	n = mb * 1024 * 1024;
+	srand(17);
+	data = allocMem(n + 1);
+	for (j = 0; j < n; ++j)
+		data[j] = rand() >> 7;
+
+	printf("%-18s %11s %11s %7s\n", "", "old", "new", "");
+
+// Best of a few rounds; the first touch of fresh memory costs more
+// than the encoding, and would go to whoever runs first.
+// base64 encode, with and without lines
+	for (k = 0; k < 2; ++k) {
+		t1 = t2 = 1e9;
+		for (j = 0; j < ROUNDS; ++j) {
+			t = now(), e1 = ref_base64Encode(data, n, !k), t = now() - t;
+			if (t < t1) t1 = t;
+			t = now(), e2 = base64Encode(data, n, !k), t = now() - t;
+			if (t < t2) t2 = t;
+			check("encode", stringEqual(e1, e2));
+			nzFree(e1), nzFree(e2);
+		}
+		report((k ? "encode" : "encode lines"), t1, t2, mb);
+	}
+
+// decode a mime body, crlf every 72 characters
+	e1 = base64Encode(data, n, true);
+	l1 = strlen(e1);
+	c1 = allocMem(l1 + 1), c2 = allocMem(l1 + 1);
+	t1 = t2 = 1e9;
+	for (j = 0; j < ROUNDS; ++j) {
+		memcpy(c1, e1, l1 + 1), memcpy(c2, e1, l1 + 1);
+		end1 = c1 + l1, end2 = c2 + l1;
+		t = now(), rc1 = ref_base64Decode(c1, &end1), t = now() - t;
+		if (t < t1) t1 = t;
+		t = now(), rc2 = base64Decode(c2, &end2), t = now() - t;
+		if (t < t2) t2 = t;
+		check("decode", rc1 == rc2 && end1 - c1 == end2 - c2 &&
+		      end2 - c2 == n && !memcmp(c1, c2, n) && !memcmp(c2, data, n));
+	}
+	report("decode", t1, t2, mb);
+	nzFree(c1), nzFree(c2), nzFree(e1);
+
+	for (j = 0; b64cases[j]; ++j) {
+		l1 = strlen(b64cases[j]);
+		c1 = cloneString(b64cases[j]), c2 = cloneString(b64cases[j]);
+		end1 = c1 + l1, end2 = c2 + l1;
+		rc1 = ref_base64Decode(c1, &end1);
+		rc2 = base64Decode(c2, &end2);
+		check(b64cases[j], rc1 == rc2 && end1 - c1 == end2 - c2 &&
+		      !memcmp(c1, c2, end1 - c1));
+		nzFree(c1), nzFree(c2);
+	}
+
+// quoted printable, mostly text with the occasional escape and soft break
+	e1 = allocMem(n + 4);
+	for (l1 = 0; ; l1 += l2) {
+		int r = rand() % 100;
+		if (r < 3)
+			l2 = sprintf(e1 + l1, "=%02X", rand() & 0xff);
+		else if (r == 3)
+			l2 = sprintf(e1 + l1, "=\n");
+		else if (r < 6)
+			l2 = sprintf(e1 + l1, "\n");
+		else
+			e1[l1] = 'a' + r % 26, l2 = 1;
+		if (l1 + l2 > n)
+			break;
+	}
+	e1[l1] = 0;
+	c1 = allocMem(l1 + 1), c2 = allocMem(l1 + 1);
+	t1 = t2 = 1e9;
+	for (j = 0; j < ROUNDS; ++j) {
+		memcpy(c1, e1, l1 + 1), memcpy(c2, e1, l1 + 1);
+		t = now(), q1 = ref_qpDecode(c1, c1 + l1), t = now() - t;
+		if (t < t1) t1 = t;
+		t = now(), q2 = qpDecode(c2, c2 + l1), t = now() - t;
+		if (t < t2) t2 = t;
+		check("qp decode", q1 - c1 == q2 - c2 && !memcmp(c1, c2, q1 - c1));
+	}
+	report("qp decode", t1, t2, mb);
+	nzFree(c1), nzFree(c2), nzFree(e1), nzFree(data);
+
+	if (failures)
+		printf("%d failures\n", failures);
+	return failures ? 2 : 0;
+}
@@ -354,9 +354,40 @@ struct shortcache {
 	char *data;
 };
 
-struct cssmaster {
+/*********************************************************************
+Compiled style sheets are kept in a process wide cache,
+keyed by the url of the sheet and a hash of its text.
+Navigating within a site brings in the same framework css on every page,
+sometimes 300K of it, and there is no need to parse it again and again.
+The descriptors are not changed by the matching process,
+except for d->highspec, which is scratch space, set before it is used,
+so one compiled sheet can be shared by many frames and many windows.
+A sheet is freed when nobody is using it and it falls off the end
+of the cache, least recently used.
+*********************************************************************/
+
+struct cssheet {
+	struct cssheet *next, *prev;
+	char *url;
+	unsigned long long hash;
+	int length;
+	bool scripting; // the scripting media query depends on js
+	int refcount;
 	struct desc *descriptors;
+	char *loadstring; // for makeSheets
+	int loadcount;
+	int errorBuckets[CSS_ERROR_LAST];
+};
+
+static struct listHead sheetCache = { &sheetCache, &sheetCache };
+static int sheetCache_n;
+#define MAXSHEETCACHE 100 // compiled sheets retained, not in use
+
+struct cssmaster {
+	struct cssheet **sheets;
+	int nsheets;
 	struct shortcache *cache;
+	bool implocal; // import files replaced locally, don't use the cache
 };
 
 static void cssPiecesFree(struct desc *d);
@@ -467,8 +498,10 @@ static void readShortCache(struct cssmaster *cm)
 		++n;
 	}
 	fclose(f);
-	if (n)
+	if (n) {
 		debugPrint(3, "%d import file replacements", n);
+		cm->implocal = true;
+	}
 }
 
 // Step back through a css string looking for the base url.
@@ -1653,14 +1686,134 @@ Frame *frameFromWindow(int gsn)
 	return 0;
 }
 
-// The selection string (start) must be allocated - css will use it in place,
-// separating it into all its descriptors.
-// cssFree() will free it.
-void cssDocLoad(int frameNumber, char *start, bool pageload)
+static void sheetFree(struct cssheet *sh)
+{
+	cssPiecesFree(sh->descriptors);
+	nzFree(sh->url);
+	nzFree(sh->loadstring);
+	free(sh);
+}
+
+// Trim the cache back to its limit, dropping sheets no frame is using.
+static void sheetCacheTrim(void)
+{
+	struct cssheet *sh, *sh2;
+	for (sh = sheetCache.prev; sh != (void *)&sheetCache; sh = sh2) {
+		sh2 = sh->prev;
+		if (sheetCache_n <= MAXSHEETCACHE)
+			break;
+		if (sh->refcount)
+			continue;
+		delFromList(sh);
+		--sheetCache_n;
+		sheetFree(sh);
+	}
+}
+
+static void sheetRelease(struct cssheet *sh)
+{
+// not in the cache, for debugging with implocal
+	if (!sh->next) {
+		sheetFree(sh);
+		return;
+	}
+	--sh->refcount;
+}
+
+/*********************************************************************
+Compile one style sheet, or find it in the cache.
+s and l delimit the sheet within the larger string of all the css,
+and url is the url of the sheet, which is already in the @ebdelim0 marker
+at the start of s, but it is handy to have it here as a key.
+The js concatenates all the sheets together, each with its delimiter,
+so we have to pull them apart here.
+*********************************************************************/
+
+static struct cssheet *sheetCompile(struct cssmaster *cm, const char *url, const char *s, int l)
+{
+	struct cssheet *sh;
+	unsigned long long h = hashBytes(s, l);
+	bool scripting = isJSAlive;
+
+	if (cm->implocal)
+		goto compile;
+	foreach(sh, sheetCache) {
+		if (sh->hash == h && sh->length == l &&
+		    sh->scripting == scripting && stringEqual(sh->url, url)) {
+			debugPrint(4, "css from cache %s", url);
+// move to the front, most recently used
+			delFromList(sh);
+			addToListFront(&sheetCache, sh);
+			++sh->refcount;
+			cssPiecesPrint(sh->descriptors);
+			return sh;
+		}
+	}
+
+compile:
+	sh = allocZeroMem(sizeof(struct cssheet));
+	sh->url = cloneString(url);
+	sh->hash = h, sh->length = l, sh->scripting = scripting;
+	loadstring = initString(&loadstring_l);
+	sh->descriptors = cssPieces(pullString(s, l));
+	sh->loadstring = loadstring;
+	loadstring = 0;
+	sh->loadcount = loadcount;
+	memcpy(sh->errorBuckets, errorBuckets, sizeof(errorBuckets));
+	if (cm->implocal)
+		return sh;
+	sh->refcount = 1;
+	addToListFront(&sheetCache, sh);
+	++sheetCache_n;
+	sheetCacheTrim();
+	return sh;
+}
+
+// split the css string into its sheets and compile each one
+static void sheetsLoad(struct cssmaster *cm, const char *start)
+{
+	const char *s = start, *t, *u;
+	char *url;
+	int n = 0;
+
+	for (t = start; (t = strstr(t, "@ebdelim0")); t += 9)
+		++n;
+	cm->sheets = allocMem((n + 1) * sizeof(struct cssheet *));
+	cm->nsheets = 0;
+
+	while (*s) {
+		t = strstr(s + 1, "@ebdelim0");
+		if (!t)
+			t = s + strlen(s);
+		url = emptyString;
+		if (!strncmp(s, "@ebdelim0", 9) &&
+		    (u = strchr(s + 9, '{')) && u < t)
+			url = pullString(s + 9, u - (s + 9));
+		cm->sheets[cm->nsheets++] = sheetCompile(cm, url, s, t - s);
+		nzFree(url);
+		s = t;
+	}
+}
+
+static void sheetsRelease(struct cssmaster *cm)
+{
+	int i;
+	for (i = 0; i < cm->nsheets; ++i)
+		sheetRelease(cm->sheets[i]);
+	nzFree(cm->sheets);
+	cm->sheets = 0;
+	cm->nsheets = 0;
+}
+
+// The selection string (start) is copied into each compiled sheet,
+// css uses those copies in place, and frees them when the sheet is freed.
+void cssDocLoad(int frameNumber, const char *start, bool pageload)
 {
 	Frame *save_cf = cf;
 	struct cssmaster *cm;
-	bool recompile = false;
+	bool recompile = false, present = false;
+	int i, j, pn;
+	char detail[40];
 	Frame *new_f = frameFromWindow(frameNumber);
 // no clue what to do if new_f is null, should never happen
 	if(new_f) cf = new_f;
@@ -1670,23 +1823,37 @@ void cssDocLoad(int frameNumber, char *start, bool pageload)
 		readShortCache(cm);
 	}
 // This could be run again and again, if the style nodes change.
-	if (cm->descriptors) {
+	if (cm->sheets) {
 		debugPrint(3,
 			   "free and recompile css descriptors due to dom changes");
-		cssPiecesFree(cm->descriptors);
+		sheetsRelease(cm);
 		recompile = true;
 	}
-	if(pageload)
-		loadstring = initString(&loadstring_l);
-	cm->descriptors = cssPieces(start);
+	pn = profBegin("css load");
+	sheetsLoad(cm, start);
+	loadcount = 0;
+	memset(errorBuckets, 0, sizeof(errorBuckets));
+	for (i = 0; i < cm->nsheets; ++i) {
+		const struct cssheet *sh = cm->sheets[i];
+		if (sh->descriptors)
+			present = true;
+		loadcount += sh->loadcount;
+		for (j = 0; j < CSS_ERROR_LAST; ++j)
+			errorBuckets[j] += sh->errorBuckets[j];
+	}
+	sprintf(detail, "%d rules", loadcount);
+	profEnd(pn, detail);
 	if(pageload) {
+		loadstring = initString(&loadstring_l);
+		for (i = 0; i < cm->nsheets; ++i)
+			stringAndString(&loadstring, &loadstring_l, cm->sheets[i]->loadstring);
 		run_function_onestring_win(cf, "makeSheets", loadstring);
 		nzFree(loadstring);
 		loadstring = 0;
 	}
 	if (recompile)
 		debugPrint(3, "css complete");
-	if (!cm->descriptors)
+	if (!present)
 		goto done;
 	if (debugCSS) {
 		FILE *f = fopen(cssDebugFile, "a");
@@ -1704,7 +1871,10 @@ void cssDocLoad(int frameNumber, char *start, bool pageload)
 	build_doclist(0);
 	hashBuild();
 	hashPrint();
+	pn = profBegin("css apply");
 	cssEverybody();
+	sprintf(detail, "%d assignments", bulktotal);
+	profEnd(pn, detail);
 	debugPrint(3, "%d css assignments", bulktotal);
 	hashFree();
 	nzFree(doclist);
@@ -1771,8 +1941,8 @@ void cssFree(Frame *f)
 	struct cssmaster *cm = f->cssmaster;
 	if (!cm)
 		return;
-	if (cm->descriptors)
-		cssPiecesFree(cm->descriptors);
+	sheetsRelease(cm);
+	sheetCacheTrim();
 	while ((c = cm->cache)) {
 		cm->cache = c->next;
 		nzFree(c->url);
@@ -3122,6 +3292,7 @@ void cssApply(int frameNumber, Tag *t, int pe)
 	Frame *save_cf = cf;
 	struct cssmaster *cm;
 	struct desc *d;
+	int i;
 	Frame *new_f = frameFromWindow(frameNumber);
 // no clue what to do if new_f is null, should never happen
 	if(new_f) cf = new_f;
@@ -3140,9 +3311,11 @@ void cssApply(int frameNumber, Tag *t, int pe)
 	nzFree(t->id);
 	t->id = get_property_string_t(t, "id");
 
-	for (d = cm->descriptors; d; d = d->next) {
-		if (qsaMatchGroup(t, d))
-			do_rules(0, d->rules, d->highspec);
+	for (i = 0; i < cm->nsheets; ++i) {
+		for (d = cm->sheets[i]->descriptors; d; d = d->next) {
+			if (qsaMatchGroup(t, d))
+				do_rules(0, d->rules, d->highspec);
+		}
 	}
 
 done:
@@ -3471,10 +3644,10 @@ static Tag **bestListAtomic(struct asel *a)
 static void cssEverybody(void)
 {
 	struct cssmaster *cm = cf->cssmaster;
-	struct desc *d0 = cm->descriptors, *d;
+	struct desc *d;
 	Tag **a, **u;
 	Tag *t;
-	int l;
+	int i, l;
 
 	bulkmatch = true;
 	bulktotal = 0;
@@ -3484,18 +3657,20 @@ static void cssEverybody(void)
 	for (l = 0; l < 6; ++l) {
 		matchhover = (l >= 3);
 		matchtype = l % 3;
-		for (d = d0; d; d = d->next) {
-			if (d->error)
-				continue;
-			a = qsa2(d, NULL);
-			if (!a)
-				continue;
-			for (u = a; (t = *u); ++u) {
-				if (!t->jslink)
+		for (i = 0; i < cm->nsheets; ++i) {
+			for (d = cm->sheets[i]->descriptors; d; d = d->next) {
+				if (d->error)
+					continue;
+				a = qsa2(d, NULL);
+				if (!a)
 					continue;
-				do_rules(t, d->rules, t->highspec);
+				for (u = a; (t = *u); ++u) {
+					if (!t->jslink)
+						continue;
+					do_rules(t, d->rules, t->highspec);
+				}
+				nzFree(a);
 			}
-			nzFree(a);
 		}
 	}
 	bulkmatch = false;
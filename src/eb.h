@@ -216,6 +216,8 @@ struct i_get {
 	bool cacheable;
 	bool last_curlin;
 	bool move_capable;
+	bool condstore_capable;
+	bool uidplus_capable;
 	char error[CURL_ERROR_SIZE + 1];
 	long code;		/* example, 404 */
 /* an assortment of variables that are gleaned from the incoming http headers */
@@ -240,6 +242,8 @@ struct MACCOUNT { // email account, pop3 or imap
 	int inport, outport;
 	uchar inssl, outssl;
 	bool nofetch, imap, secure, maskon, maskactive, dxon, move_capable, mc_set;
+	bool condstore; // server keeps modification sequences, rfc 7162
+	bool uidplus; // server can expunge by uid, rfc 4315
 	const char *cclist[MAXCC + 1]; // extra cc directives
 	uchar cctype[MAXCC]; // cc or bcc or attach
 	const char *isub; // substring of folders
@@ -292,6 +296,7 @@ extern int verifyCertificates;	/* is a certificate required for the ssl connecti
 extern int displayLength;	// when printing a line
 extern int formatLineLength;	// when formatting html
 extern bool formatOverflow;
+extern void (*reformatHook)(int pass, const char *buf); // see reformcheck.c
 extern int webTimeout, mailTimeout;
 extern uchar browseLocal;
 extern bool sqlPresent;		/* Was edbrowse compiled with SQL built in? */
@@ -479,9 +484,16 @@ struct ebWindow {
  * and used thereafter for hyperlinks, fill-out forms, etc. */
 	struct htmlTag **tags;
 	int numTags, allocTags, deadTags;
+	struct tagArena *tagArena; // storage for the tags, see html-tags.c
 int ehsn;
 	struct htmlTag *scriptlist, *inputlist, *optlist, *linklist;
 	struct htmlTag *framelist;
+// selects and datalists whose options js has touched, see rebuildSelectors
+	struct htmlTag *seldirty;
+// hashes of the last rendered text and its reformat, see rrReformat
+	unsigned long long rrhash, rrfhash;
+	int rrll; // line length of that reformat
+	bool rrov; // formatOverflow for that reformat
 	bool mustrender:1;
 	bool sank:1; /* jSyncup has been run */
 	bool lhs_yes:1;
@@ -527,6 +539,7 @@ int ehsn;
 	int imap_l; // fetch limit
 	CURL *imap_h; // imap server handle
 	char *mail_raw; // the email you're looking at
+	char *mailSpill; // temp files of its large attachments, one per line
 	struct DBTABLE *table;	// if in sqlMode
 	time_t nextrender;
 };
@@ -591,6 +604,8 @@ struct htmlTag {
 	jsobjtype jv;		// javascript value
 	int seqno; // tag sequence number in this window
 	int gsn; // global sequence number, for rooting
+	unsigned visitgen; // the last traversal that reached this tag
+	struct htmlTag *dirtynext; // next select on the window's seldirty list
 	char *js_file;
 	int js_ln;			// line number of javascript
 	int lic;		// list item count, highly overloaded
@@ -642,13 +657,14 @@ struct htmlTag {
 	bool onload:1;
 	bool onunload:1;
 	bool doorway:1; /* doorway to javascript */
-	bool visited:1;
 	bool masked:1;
 	bool iscolor:1;
 	bool ur:1;		// row unfolded, only for trf
 	bool inur:1;		// in ur command
 	bool threadcreated:1;
 	bool threadjoined:1;
+	bool seldirty:1; // on the window's seldirty list
+	bool jschecked:1; // js checked or unchecked this box since we last read it
 	char subsup;		/* span turned into sup or sub */
 	uchar itype;		// input type =
 	uchar itype_minor;
@@ -746,7 +762,6 @@ extern const char *const inp_others[];
 
 /* For traversing a tree of html nodes, this is the callback function */
 typedef void (*nodeFunction) (struct htmlTag * node, bool opentag);
-extern nodeFunction traverse_callback;
 
 /* Return codes for base64Decode() */
 #define GOOD_BASE64_DECODE 0
@@ -71,8 +71,11 @@ void setFetchLimit(const char *s);
 int fetchMail(int account);
 int fetchAllMail(void);
 void scanUnreadMail(void);
+char *mailSearch(const char *query, int *len_p);
+bool mailIndexFile(const char *file);
 bool emailTest(void);
 void mail64Error(int err);
+void mailSpillFree(Window *w);
 char *emailParse(char *buf, bool plain);
 bool setupReply(bool all);
 bool imapBufferPresent(void);
@@ -93,6 +96,10 @@ bool addFolders();
 bool deleteFolder(int ln);
 bool renameFolder(const char *src, const char *dest);
 void imapCleanupInBackground(CURL *h);
+int imapIdleDelay(void);
+void imapIdleStop(const Window *w);
+bool imapIdle(void);
+void imapIdlePoll(void);
 
 // sourcefile=format.c
 void prepareForBrowse(char *h, int h_len);
@@ -120,6 +127,7 @@ char *force_utf8( char *buf, int buflen);
 char *base64Encode(const char *inbuf, int inlen, bool lines);
 uchar base64Bits(char c);
 int base64Decode(char *start, char **end);
+char *qpDecode(char *start, char *end);
 void iuReformat(const char *inbuf, int inbuflen, char **outbuf_p, int *outbuflen_p);
 char *makeDosNewlines(char *p);
 bool parseDataURI(const char *uri, char **mediatype, char **data, int *data_l);
@@ -157,6 +165,10 @@ void preFormatCheck(int tagno, bool * pretag, bool * slash);
 char *htmlParse(char *buf, int remote);
 bool htmlTest(void);
 bool browseCurrentBuffer(const char *suffix, bool plain) ;
+void profReset(const char *url, bool fetching);
+int profBegin(const char *name);
+void profEnd(int n, const char *detail);
+bool profCommand(const char *file);
 void infShow(int tagno, const char *search);
 bool infReplace(int tagno, char *newtext, bool notify);
 char *displayOptions(const Tag *sel);
@@ -194,9 +206,10 @@ void setTagAttr(Tag *t, const char *name, char *val);
 const char *attribVal(const Tag *t, const char *name);
 bool attribPresent(const Tag *t, const char *name);
 Tag *newTag(const Frame *f, const char *tagname);
+const struct tagInfo *tagInfoByName(const char *name);
 void freeTags(struct ebWindow *w);
 void initTagArray(void);
-void traverseAll(void);
+void traverseAll(nodeFunction fn);
 Tag *findOpenTag(Tag *t, int action);
 Tag *findOpenSection(Tag *t);
 Tag *findOpenList(Tag *t);
@@ -218,6 +231,7 @@ bool httpConnect(struct i_get *g);
 void *httpConnectBack1(void *ptr);
 void *httpConnectBack2(void *ptr);
 void *httpConnectBack3(void *ptr);
+bool preloadClaim(struct i_get *g, bool *rc);
 void ebcurl_setError(CURLcode curlret, const char *url, int action, const char *curl_error);
 int ftpWrite(const char *url);
 void setHTTPLanguage(const char *lang);
@@ -263,6 +277,7 @@ bool sendMailCurrent(int sm_account, bool dosig);
 void *allocMem(size_t n);
 void *allocZeroMem(size_t n);
 void *reallocMem(void *p, size_t n);
+long long allocTotal(void);
 char *allocString(size_t n) ;
 char *allocZeroString(size_t n) ;
 char *reallocString(void *p, size_t n) ;
@@ -292,6 +307,7 @@ char *pullString1(const char *s, const char *t) ;
 int stringIsNum(const char *s) ;
 bool stringIsDate(const char *s) ;
 bool stringIsFloat(const char *s, double *dp) ;
+unsigned long long hashBytes(const char *s, int len) ;
 bool memEqualCI(const char *s, const char *t, int len) ;
 const char *stringInBufLine(const char *s, const char *t);
 const char *charInBufLine(const char *s, char t);
@@ -432,7 +448,7 @@ void ircReadlineRelease(void);
 void writeShortCache(void);
 bool matchMedia(char *t);
 Frame *frameFromWindow(int gsn);
-void cssDocLoad(int frameNumber, char *s, bool pageload);
+void cssDocLoad(int frameNumber, const char *s, bool pageload);
 void cssFree(Frame *f);
 Tag **querySelectorAll(const char *selstring, Tag *top);
 Tag *querySelector(const char *selstring, Tag *top);
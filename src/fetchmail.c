@@ -6,6 +6,10 @@
 
 #include "eb.h"
 
+#ifndef _MSC_VER
+#include <sys/wait.h>
+#endif
+
 #define MHLINE 512		// length of a mail header line
 // headers and other information about an email
 struct MHINFO {
@@ -33,6 +37,7 @@ struct MHINFO {
 	bool dispat;
 	uchar error64;
 	bool startAllocated;
+	char *spill;		// large attachment, decoded, in the temp directory
 };
 
 static int nattach;		// number of attachments
@@ -61,6 +66,7 @@ static void freeMailInfo(struct MHINFO *w)
 	}
 	nzFree(w->tolist);
 	nzFree(w->cclist);
+	nzFree(w->spill);
 	if(w->startAllocated) nzFree(w->start);
 	nzFree(w);
 }
@@ -161,6 +167,13 @@ static void linkAttachment(struct MHINFO *w)
 // The irony - it probably came in base64, I turned it into binary,
 // now I'm turning it back into base64, so that edbrowse can once again
 // turn it into binary when you click on the hyperlink.
+	if (w->spill) {
+		stringAndString(&imapLines, &iml_l, "<br><a href='file://");
+		e = htmlEscape(w->spill);
+		stringAndString(&imapLines, &iml_l, e);
+		nzFree(e);
+		goto named;
+	}
 	stringAndString(&imapLines, &iml_l, "<br><a href='data:");
 // can't we pull content-type out of the attachment and put it in here?
 	stringAndString(&imapLines, &iml_l,  "unknown");
@@ -185,6 +198,7 @@ static void linkAttachment(struct MHINFO *w)
 	}
 	stringAndString(&imapLines, &iml_l, e);
 	nzFree(e);
+named:
 	if (w->cfn[0]) {
 		stringAndString(&imapLines, &iml_l,  "' download='");
 		e = htmlEscape(w->cfn);
@@ -306,8 +320,11 @@ static struct FOLDER {
 	int unread;		/* how many not yet seen */
 	int start;
 	int uidnext;		/* uid of next message */
+	unsigned uidvalidity;
+	unsigned long long modseq;	// highest modification sequence, condstore
 	struct MIF *mlist;	/* allocated */
 	char *cbase; // allocated
+	char *ecbase; // envelope cache, strings for mlist, allocated
 } *topfolders;
 
 static struct MACCOUNT *active_a;
@@ -565,6 +582,8 @@ static void folderlistByName(const char *line, uchar *list, uchar *first)
 	}
 }
 
+static void selCheck(CURL * h, CURLcode res);
+
 /* data block for the curl ccallback write function in http.c */
 static struct i_get callback_data;
 static char cerror[CURL_ERROR_SIZE + 1];
@@ -576,16 +595,26 @@ static CURLcode getMailData(CURL * h)
 	cerror[0] = 0;
 	callback_data.buffer = initString(&callback_data.length);
 	callback_data.move_capable = false;
+	callback_data.condstore_capable = false;
+	callback_data.uidplus_capable = false;
 	res = curl_easy_perform(h);
 	mailstring = callback_data.buffer;
 	mailstring_l = callback_data.length;
 	callback_data.buffer = 0;
+	if (isimap)
+		selCheck(h, res);
 	if (!active_a->mc_set) {
 		active_a->move_capable = callback_data.move_capable;
+		active_a->condstore = callback_data.condstore_capable;
+		active_a->uidplus = callback_data.uidplus_capable;
 		if (debugLevel < 4)
 			curl_easy_setopt(h, CURLOPT_VERBOSE, 0);
 		debugPrint(3, "imap is %smove capable",
 			   (active_a->move_capable ? "" : "not "));
+		debugPrint(3, "imap is %scondstore capable",
+			   (active_a->condstore ? "" : "not "));
+		debugPrint(3, "imap is %suidplus capable",
+			   (active_a->uidplus ? "" : "not "));
 		active_a->mc_set = true;
 	}
 	return res;
@@ -646,6 +675,7 @@ static void isoDecode(char *vl, char **vrp);
 static void cleanFolder(struct FOLDER *f)
 {
 	nzFree(f->cbase), f->cbase = NULL;
+	nzFree(f->ecbase), f->ecbase = NULL;
 	nzFree(f->mlist), f->mlist = NULL;
 	f->nmsgs = f->nfetch = f->unread = 0;
 }
@@ -826,25 +856,151 @@ static void viewAll(struct FOLDER *f)
 	}
 }
 
-static bool expunge(CURL * handle)
+static CURLcode expunge(CURL * handle)
 {
 	CURLcode res;
 	curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "EXPUNGE");
 	res = getMailData(handle);
 	nzFree(mailstring), mailstring = 0;
-	return res == CURLE_OK;
+	return res;
+}
+
+/*********************************************************************
+Bulk operations go to the server as uid sets, 1:5,9,12:40,
+one command for the lot rather than one per message.
+The uids are sorted and consecutive runs collapse to a:b.
+rfc 7162 asks clients to keep a command line under 8000 octets,
+some older servers choke well before that,
+so a set that grows past UIDSETMAX is cut and sent in pieces.
+*********************************************************************/
+
+#define UIDSETMAX 1000
+
+static int uidCompare(const void *s, const void *t)
+{
+	int a = *(const int *)s, b = *(const int *)t;
+	return a < b ? -1 : a > b;
+}
+
+// Append a uid set, starting at uids[j], to the string.
+// Stop when the string is long enough; return the first uid not covered.
+static int uidSet(char **sp, int *lp, const int *uids, int j, int n)
+{
+	int k, l0 = *lp;
+	for (; j < n && *lp - l0 < UIDSETMAX; j = k) {
+		for (k = j + 1; k < n && uids[k] <= uids[k - 1] + 1; ++k) ;
+		if (*lp > l0)
+			stringAndChar(sp, lp, ',');
+		stringAndNum(sp, lp, uids[j]);
+		if (uids[k - 1] != uids[j]) {
+			stringAndChar(sp, lp, ':');
+			stringAndNum(sp, lp, uids[k - 1]);
+		}
+	}
+	return j;
+}
+
+static bool tryTwice(CURL *h, const char *path, const char *cmd);
+static CURLcode uidres; // why uidCommand failed, when there is no path
+
+// Send UID verb set tail, in as many pieces as it takes.
+// uids must be sorted.
+// With a path, each piece goes through tryTwice and sets the error on failure.
+// Without, the folder is already selected, as in the interactive client,
+// and the caller handles the retry; uidres holds the curl error.
+static bool uidCommand(CURL * h, const char *path, const char *verb,
+		       const int *uids, int n, const char *tail)
+{
+	int j = 0, l;
+	char *cmd;
+	CURLcode res;
+	bool rc;
+
+	while (j < n) {
+		cmd = initString(&l);
+		stringAndString(&cmd, &l, "UID ");
+		stringAndString(&cmd, &l, verb);
+		stringAndChar(&cmd, &l, ' ');
+		j = uidSet(&cmd, &l, uids, j, n);
+		if (*tail) {
+			stringAndChar(&cmd, &l, ' ');
+			stringAndString(&cmd, &l, tail);
+		}
+		debugPrint(4, "%s", cmd);
+		if (path) {
+			rc = tryTwice(h, path, cmd);
+		} else {
+			curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, cmd);
+			res = getMailData(h);
+			nzFree(mailstring), mailstring = 0;
+			rc = ((uidres = res) == CURLE_OK);
+		}
+		nzFree(cmd);
+		if (!rc)
+			return false;
+	}
+	return true;
+}
+
+/*********************************************************************
+Expunge the messages we just flagged.
+With uidplus we name them, and leave alone anything some other client
+has flagged for deletion but not yet expunged.
+The messages are flagged deleted on the server by now,
+so they are gone as far as the caller is concerned,
+and come out of the buffer, whether or not the expunge goes through.
+If it doesn't, say so here; the next expunge will pick them up.
+*********************************************************************/
+
+static void uidExpunge(CURL * h, const char *path, const int *uids, int n)
+{
+	CURLcode res;
+	if (!active_a->uidplus)
+		res = expunge(h);
+	else if (uidCommand(h, path, "EXPUNGE", uids, n, ""))
+		res = CURLE_OK;
+	else if (path) {
+// tryTwice has set the error
+		showError();
+		return;
+	} else
+		res = uidres;
+	if (res != CURLE_OK)
+		ebcurl_setError(res, (path ? cf->firstURL : mailbox_url), 1, cerror);
+}
+
+// Flag the messages deleted and expunge them.
+static bool uidDelete(CURL * h, const char *path, const int *uids, int n)
+{
+	if (!uidCommand(h, path, "STORE", uids, n, "+FLAGS.SILENT (\\Deleted)"))
+		return false;
+	uidExpunge(h, path, uids, n);
+	return true;
+}
+
+// Move or copy the messages to another folder.
+// Without the move extension, move is copy then delete.
+static bool uidMovecopy(CURL * h, const char *path, const int *uids, int n,
+			bool move, const char *dest)
+{
+	char *tail;
+	bool rc;
+	move &= active_a->move_capable;
+	ignore = asprintf(&tail, "\"%s\"", dest);
+	rc = uidCommand(h, path, (move ? "MOVE" : "COPY"), uids, n, tail);
+	free(tail);
+	return rc;
 }
 
 static bool bulkMoveDelete(CURL * handle, struct FOLDER *f,
 			  struct MIF *this_mif, char key, char subkey,
 			  struct FOLDER *destination)
 {
-	CURLcode res;
-	char cust_cmd[80];
-	int j;
-	struct MIF *mif = f->mlist;
-	char *t, *fromline = 0;
-	bool deleted = false;
+	int j, n = 0;
+	int *uids;
+	struct MIF *mif;
+	char *fromline = 0;
+	bool rc = true;
 
 	if (key == 'f') {
 		fromline = this_mif->from;
@@ -854,58 +1010,130 @@ static bool bulkMoveDelete(CURL * handle, struct FOLDER *f,
 		}
 	}
 
-	for (j = 0; j < f->nfetch; ++j, ++mif) {
-		bool delflag = false;
+	uids = allocMem((f->nfetch + 1) * sizeof(int));
+	for (j = 0, mif = f->mlist; j < f->nfetch; ++j, ++mif) {
 		if (mif->gone)
 			continue;
 		if (fromline && !stringEqual(fromline, mif->from))
 			continue;
-		if (subkey == 'm') {
-			ignore = asprintf(&t, "UID %s %d \"%s\"",
-				     (active_a->move_capable ? "MOVE" : "COPY"),
-				     mif->uid, destination->path);
-			curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, t);
-			free(t);
-			res = getMailData(handle);
-			nzFree(mailstring), mailstring = 0;
-			if (res != CURLE_OK)
-				goto abort;
-			if (active_a->move_capable) mif->gone = true;
-			else delflag = true;
-		}
+		uids[n++] = mif->uid;
+	}
+	if (!n)
+		goto done;
+	qsort(uids, n, sizeof(int), uidCompare);
 
-		if (subkey == 'd' || delflag) {
-			sprintf(cust_cmd, "uid STORE %d +Flags \\Deleted", mif->uid);
-			curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, cust_cmd);
-			res = getMailData(handle);
-			nzFree(mailstring);
-			if (res != CURLE_OK)
-				goto abort;
-			deleted = true;
-			mif->gone = true;
-		}
+	if (subkey == 'm') {
+		rc = uidMovecopy(handle, 0, uids, n, true, destination->path);
+		if (rc && !active_a->move_capable)
+			rc = uidDelete(handle, 0, uids, n);
+	} else {
+		rc = uidDelete(handle, 0, uids, n);
 	}
+	if (!rc)
+		goto done;
 
-	if(deleted && !expunge(handle)) goto abort;
-	return true;
+	for (j = 0, mif = f->mlist; j < f->nfetch; ++j, ++mif) {
+		if (mif->gone)
+			continue;
+		if (fromline && !stringEqual(fromline, mif->from))
+			continue;
+		mif->gone = true;
+	}
 
-abort:
-	return false;
+done:
+	nzFree(uids);
+	return rc;
+}
+
+/*********************************************************************
+Remember which folder is selected on each imap connection,
+so we don't select it again before every command.
+Envelopes, reading a message, moving or deleting it, searching,
+each of these used to start with SELECT, another round trip,
+and a busy server redoing its counts.
+curl reconnects quietly if the server hung up on us,
+and the new connection has nothing selected;
+it tells us how many connections it made for the last transfer,
+so we can forget the selection when that happens, or on any error.
+*********************************************************************/
+
+struct SELECTED {
+	struct SELECTED *next, *prev;
+	CURL *h;
+	char *path;
+};
+static struct listHead selectedList = { &selectedList, &selectedList };
+
+static struct SELECTED *selFind(CURL * h)
+{
+	struct SELECTED *s;
+	foreach(s, selectedList)
+	    if (s->h == h)
+		return s;
+	return 0;
+}
+
+static void selForget(CURL * h)
+{
+	struct SELECTED *s = selFind(h);
+	if (!s)
+		return;
+	delFromList(s);
+	nzFree(s->path);
+	free(s);
+}
+
+static void selCheck(CURL * h, CURLcode res)
+{
+	long nc = 0;
+	curl_easy_getinfo(h, CURLINFO_NUM_CONNECTS, &nc);
+	if (res != CURLE_OK || nc > 0)
+		selForget(h);
+}
+
+// Select a folder, unless it is selected already.
+// force is for fresh counts, or after an error.
+// nocond leaves off condstore, for a server that advertises it,
+// then rejects it on select.
+// mailstring holds the response, or is null if there was nothing to do.
+static CURLcode selectFolder(CURL * h, const char *path, bool force, bool nocond)
+{
+	struct SELECTED *s = selFind(h);
+	CURLcode res;
+	char *t;
+
+	mailstring = 0;
+	if (!force && s && stringEqual(s->path, path)) {
+		debugPrint(4, "%s is selected", path);
+		return CURLE_OK;
+	}
+// condstore gives us the highest modification sequence, for the envelope cache
+	ignore = asprintf(&t, "SELECT \"%s\"%s", path,
+	(active_a->condstore && !nocond ? " (CONDSTORE)" : ""));
+	curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, t);
+	free(t);
+	res = getMailData(h);
+	if (res != CURLE_OK)
+		return res;
+	if (!(s = selFind(h))) {
+		s = allocZeroMem(sizeof(struct SELECTED));
+		s->h = h;
+		addToListBack(&selectedList, s);
+	}
+	nzFree(s->path);
+	s->path = cloneString(path);
+	return res;
 }
 
 // go back into a folder after a disconnect and reconnect
 static bool refolder(CURL *h, struct FOLDER *f, CURLcode res1)
 {
 	CURLcode res2;
-	char *t;
 // We should check here that res1 is the right kind of error,
 // If some other error code then return false;
 // Let's at least print it out.
 	if(res1 != CURLE_OK && debugLevel >= 3) ebcurl_setError(res1, "mail://url-unspecified", 1, cerror);
-	ignore = asprintf(&t, "SELECT \"%s\"", f->path);
-	curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, t);
-	free(t);
-	res2 = getMailData(h);
+	res2 = selectFolder(h, f->path, true, false);
 	nzFree(mailstring), mailstring = 0;
 	if(res2 == CURLE_OK) {
 		debugPrint(2, "reconnect to %s", withoutSubstring(f));
@@ -931,9 +1159,14 @@ static bool tryTwice(CURL *h, const char *path, const char *cmd)
 	curl_easy_setopt(h, CURLOPT_VERBOSE, (debugLevel >= 4));
 
 again:
-	curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, cmd);
-	res = getMailData(h);
+// make sure the command lands in the right folder
+	res = selectFolder(h, path, false, false);
 	nzFree(mailstring), mailstring = 0;
+	if (res == CURLE_OK) {
+		curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, cmd);
+		res = getMailData(h);
+		nzFree(mailstring), mailstring = 0;
+	}
 	if (res != CURLE_OK) {
 		if(retry || !refolder(h, &f0, res))
 			goto abort;
@@ -957,6 +1190,10 @@ static CURLcode downloadBody(CURL *h, struct FOLDER *f, int uid)
 	char cust_cmd[80];
 
 	retry = partread = false;
+	res = selectFolder(h, f->path, false, false);
+	nzFree(mailstring), mailstring = 0;
+	if (res != CURLE_OK && !refolder(h, f, res))
+		return res;
 redown:
 	sprintf(cust_cmd, "UID FETCH %d BODY[]", uid);
 	curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, cust_cmd);
@@ -981,6 +1218,7 @@ You'll see this after the perform function runs.
 	callback_data.buffer = initString(&callback_data.length);
 	cerror[0] = 0;
 	res = curl_easy_perform(h);
+	selCheck(h, res);
 // and put things back
 //	curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, eb_curl_callback);
 	curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, NULL);
@@ -1071,11 +1309,9 @@ static void scanFolder(CURL * handle, struct FOLDER *f)
 		return;
 	}
 
-// tell the server to descend into this folder
-	ignore = asprintf(&t, "SELECT \"%s\"", f->path);
-	curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, t);
-	free(t);
-	res = getMailData(handle);
+// tell the server to descend into this folder,
+// though examineFolder has usually done it for us
+	res = selectFolder(handle, f->path, false, false);
 	nzFree(mailstring);
 	if (res != CURLE_OK) {
 abort:
@@ -1368,7 +1604,7 @@ redelete:
 			g = topfolders + active_a->dxtrash - 1;
 			goto re_move;
 		}
-		sprintf(cust_cmd, "UID STORE %d +Flags \\Deleted", mif->uid);
+		sprintf(cust_cmd, "UID STORE %d +FLAGS.SILENT (\\Deleted)", mif->uid);
 		curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, cust_cmd);
 		res = getMailData(handle);
 		nzFree(mailstring);
@@ -1380,7 +1616,7 @@ redelete:
 		}
 		mif->gone = true;
 		debugPrint(3, "` %d EXPUNGE", mif->uid);
-		if(!expunge(handle)) goto abort;
+		uidExpunge(handle, 0, &mif->uid, 1);
 	}
 
 	i_puts(MSG_EndFolder);
@@ -1457,53 +1693,302 @@ char **name, char **addr)
 	return true;
 }
 
+/*********************************************************************
+The envelope cache.
+Entering a folder used to fetch the uid and envelope of every message
+in the fetch range, every time, and a refresh did it all again.
+Now the envelopes are kept on disk, a file per account and folder,
+under $cacheDir/imap, good as long as the folder's uidvalidity holds.
+If the server supports condstore, and the highest modification sequence,
+the message count, and uidnext are all as they were,
+nothing has changed and we fetch nothing at all.
+If only the modseq has moved, messages were flagged but none came or went,
+so the numbering still holds; ask for the flags that changed since then.
+Otherwise fetch uids and flags for the range, which is cheap,
+and envelopes only for the uids we haven't seen.
+The file is text, a header line, then a line per message, tab separated,
+uid seqno size sent seen subject from reply to prec refer.
+Only ranges are saved; a search is a different set of messages,
+though it can still pull envelopes out of the cache.
+*********************************************************************/
+
+#define ENVCACHEVERSION 1
+
+struct ENVCACHE {
+	unsigned uidvalidity;
+	unsigned long long modseq;
+	int uidnext, nmsgs, start, nfetch;
+	int n;
+	struct MIF *list;	// allocated, strings are in f->ecbase
+};
+
+static char *envCacheFile(const struct FOLDER *f)
+{
+	static bool tried;
+	char *dir, *key, *file;
+	unsigned long long h;
+
+	if (!cacheDir && !tried) {
+// edbrowse -f doesn't set up the http cache, but we want its directory
+		tried = true;
+		setupEdbrowseCache();
+	}
+	if (!cacheDir)
+		return 0;
+	ignore = asprintf(&dir, "%s/imap", cacheDir);
+	if (fileTypeByName(dir, 0) != 'd' && mkdir(dir, 0700)) {
+		free(dir);
+		return 0;
+	}
+	ignore = asprintf(&key, "%s@%s:%d/%s", active_a->login,
+	active_a->inurl, active_a->inport, f->path);
+	h = hashBytes(key, strlen(key));
+	ignore = asprintf(&file, "%s/%016llx", dir, h);
+	free(key);
+	free(dir);
+	return file;
+}
+
+// split off the next tab delimited field
+static char *ecField(char **t)
+{
+	char *s = *t, *u = strchr(s, '\t');
+	if (u)
+		*u++ = 0;
+	else
+		u = s + strlen(s);
+	*t = u;
+	return s;
+}
+
+static bool envCacheLoad(struct FOLDER *f, struct ENVCACHE *ec)
+{
+	char *file, *buf, *t, *u, *v;
+	int len, version, j, k;
+	struct MIF *mif;
+
+	memset(ec, 0, sizeof(*ec));
+	if (!f->uidvalidity || !(file = envCacheFile(f)))
+		return false;
+	if (fileTypeByName(file, 0) != 'f' ||
+	    !fileIntoMemory(file, &buf, &len, 0)) {
+		free(file);
+		return false;
+	}
+	free(file);
+	if (sscanf(buf, "%d %u %llu %d %d %d %d %d", &version,
+		   &ec->uidvalidity, &ec->modseq, &ec->uidnext, &ec->nmsgs,
+		   &ec->start, &ec->nfetch, &ec->n) != 8 ||
+	    version != ENVCACHEVERSION || ec->uidvalidity != f->uidvalidity ||
+	    ec->n <= 0 || !(t = strchr(buf, '\n'))) {
+		nzFree(buf);
+		ec->n = 0;
+		return false;
+	}
+
+	ec->list = allocZeroMem(ec->n * sizeof(struct MIF));
+	for (j = 0, ++t; *t && j < ec->n; t = u) {
+		if ((u = strchr(t, '\n')))
+			*u++ = 0;
+		else
+			u = t + strlen(t);
+// 11 fields; a short line means the file was cut off
+		for (k = 0, v = t; *v; ++v)
+			if (*v == '\t')
+				++k;
+		if (k != 10 || atoi(t) <= 0)
+			break;
+		mif = ec->list + j;
+		mif->uid = atoi(ecField(&t));
+		mif->seqno = atoi(ecField(&t));
+		mif->size = atoi(ecField(&t));
+		mif->sent = atoll(ecField(&t));
+		mif->seen = (*ecField(&t) == '1');
+		mif->subject = ecField(&t);
+		mif->from = ecField(&t);
+		mif->reply = ecField(&t);
+		mif->to = ecField(&t);
+		mif->prec = ecField(&t);
+		mif->refer = ecField(&t);
+		++j;
+	}
+	ec->n = j;
+	nzFree(f->ecbase);
+	f->ecbase = buf;
+	return true;
+}
+
+static void ecPut(char **s, int *l, const char *v)
+{
+	stringAndChar(s, l, '\t');
+	if (!v)
+		return;
+	for (; *v; ++v)
+		stringAndChar(s, l, (*v == '\t' || *v == '\r' || *v == '\n') ? ' ' : *v);
+}
+
+static void envCacheSave(const struct FOLDER *f)
+{
+	char *file, *tmp, *s;
+	int l, j, n;
+	const struct MIF *mif;
+	char line[120];
+
+	if (!f->uidvalidity || !f->nfetch || !(file = envCacheFile(f)))
+		return;
+	for (j = n = 0; j < f->nfetch; ++j)
+		if (f->mlist[j].uid)
+			++n;
+	s = initString(&l);
+	sprintf(line, "%d %u %llu %d %d %d %d %d\n", ENVCACHEVERSION,
+		f->uidvalidity, f->modseq, f->uidnext, f->nmsgs,
+		f->start, f->nfetch, n);
+	stringAndString(&s, &l, line);
+	for (j = 0, mif = f->mlist; j < f->nfetch; ++j, ++mif) {
+		if (!mif->uid)
+			continue;
+		sprintf(line, "%d\t%d\t%d\t%lld\t%d", mif->uid, mif->seqno,
+			mif->size, (long long)mif->sent, mif->seen);
+		stringAndString(&s, &l, line);
+		ecPut(&s, &l, mif->subject);
+		ecPut(&s, &l, mif->from);
+		ecPut(&s, &l, mif->reply);
+		ecPut(&s, &l, mif->to);
+		ecPut(&s, &l, mif->prec);
+		ecPut(&s, &l, mif->refer);
+		stringAndChar(&s, &l, '\n');
+	}
+// write it aside and rename, so a reader never sees half a file
+	ignore = asprintf(&tmp, "%s.tmp", file);
+	if (memoryOutToFile(tmp, s, l))
+		rename(tmp, file);
+	free(tmp);
+	free(file);
+	nzFree(s);
+}
+
+// the lists are in ascending order, by sequence number and so by uid
+static struct MIF *mifByUid(struct MIF *list, int n, int uid)
+{
+	int lo = 0, hi = n - 1, m;
+	while (lo <= hi) {
+		m = (lo + hi) / 2;
+		if (list[m].uid == uid)
+			return list + m;
+		if (list[m].uid < uid)
+			lo = m + 1;
+		else
+			hi = m - 1;
+	}
+	return 0;
+}
+
+static struct MIF *mifBySeqno(struct FOLDER *f, int seqno)
+{
+	int lo = 0, hi = f->nfetch - 1, m;
+	struct MIF *list = f->mlist;
+	while (lo <= hi) {
+		m = (lo + hi) / 2;
+		if (list[m].seqno == seqno)
+			return list + m;
+		if (list[m].seqno < seqno)
+			lo = m + 1;
+		else
+			hi = m - 1;
+	}
+	return 0;
+}
+
+static void envFromCache(struct MIF *mif, const struct MIF *c, bool flags)
+{
+	mif->uid = c->uid;
+	mif->size = c->size;
+	mif->sent = c->sent;
+	mif->subject = c->subject;
+	mif->from = c->from;
+	mif->reply = c->reply;
+	mif->to = c->to;
+	mif->prec = c->prec;
+	mif->refer = c->refer;
+	if (flags)
+		mif->seen = c->seen;
+}
+
+/*********************************************************************
+Crack the untagged responses to FETCH (UID FLAGS).
+Each response is matched to its message by sequence number,
+or by uid for a changedsince fetch, where only some messages come back.
+*********************************************************************/
+
+static void uidsAndFlags(struct FOLDER *f, bool byuid)
+{
+	char *t = mailstring, *u, *v, *w, *q;
+	struct MIF *mif;
+
+	if (!t)
+		return;
+	while ((t = strstr(t, " FETCH ("))) {
+		for (q = t; q > mailstring && isdigitByte(q[-1]); --q) ;
+		mif = (byuid ? 0 : mifBySeqno(f, atoi(q)));
+		t += 8;
+		if ((u = strstr(t, " FETCH (")))
+			*u = 0;
+		if ((v = strstr(t, "UID ")) && isdigitByte(v[4])) {
+			if (byuid)
+				mif = mifByUid(f->mlist, f->nfetch, atoi(v + 4));
+			else if (mif)
+				mif->uid = atoi(v + 4);
+		}
+		if (mif && (v = strstr(t, "FLAGS ("))) {
+			if ((w = strchr(v, ')')))
+				*w = 0;
+			mif->seen = (strstr(v, "\\Seen") != 0);
+			if (w)
+				*w = ')';
+		}
+		if (!u)
+			break;
+		*u = ' ';
+		t = u;
+	}
+}
+
+// sequence numbers of the listed messages, runs collapsed, as in 3,5:9,12
+static char *seqnoSet(const struct FOLDER *f, const int *idx, int n)
+{
+	char *s;
+	int l, j, k;
+	s = initString(&l);
+	for (j = 0; j < n; j = k) {
+		for (k = j + 1; k < n &&
+		     f->mlist[idx[k]].seqno == f->mlist[idx[k - 1]].seqno + 1; ++k) ;
+		if (j)
+			stringAndChar(&s, &l, ',');
+		stringAndNum(&s, &l, f->mlist[idx[j]].seqno);
+		if (k - j > 1) {
+			stringAndChar(&s, &l, ':');
+			stringAndNum(&s, &l, f->mlist[idx[k - 1]].seqno);
+		}
+	}
+	return s;
+}
+
 static bool envelopes(CURL * handle, struct FOLDER *f)
 {
-	int j;
+	int j, nmiss;
 	char *t, *u;
 	CURLcode res;
 	int sublength;
-	char cust_cmd[80];
 	char nf[24]; // next fetch
 	char *sfp; // start fetch pointer
 	char *nfp; // next fetch pointer
 	struct MIF *mif;
+	const struct MIF *c;
+	struct ENVCACHE ec;
+	int *idx;
+	char *set;
+	bool isrange = true, same;
 
-// when this comes from a search, not a normal descend,
-// the emails are not in order, and we can't use a range.
-// Check for this and build a list instead.
-	imapLines = initString(&iml_l);
-	mif = f->mlist;
-	if(mif->seqno == f->start) {
-		for (j = 1, ++mif; j < f->nfetch; ++j, ++mif)
-			if(mif->seqno != mif[-1].seqno + 1) break;
-		if(j == f->nfetch) goto range;
-	}
-
-// Ouch! Make the list.
-	mif = f->mlist;
-	for (j = 0; j < f->nfetch; ++j, ++mif) {
-		if(j) stringAndChar(&imapLines, &iml_l, ',');
-	stringAndNum(&imapLines, &iml_l, mif->seqno);
-	}
-
-range:
-// capture the uids
-	if(*imapLines) {
-		ignore = asprintf(&t, "FETCH %s UID", imapLines);
-	} else {
-		sprintf(cust_cmd, "FETCH %d:%d UID", f->start, f->start + f->nfetch - 1);
-		t = cust_cmd;
-	}
-	curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, t);
-	if(*imapLines) free(t);
-	res = getMailData(handle);
-	if (res != CURLE_OK) goto abort;
-#if 0
-	FILE *z; z = fopen("ms1", "w"); fprintf(z, "%s", mailstring); fclose(z);
-#endif
-
-	t = mailstring;
 	for (j = 0; j < f->nfetch; ++j) {
 		mif = f->mlist + j;
 // defaults
@@ -1514,29 +1999,75 @@ range:
 		mif->reply = emptyString;
 		mif->prec = emptyString;
 		mif->ccrec = emptyString;
+// when this comes from a search, not a normal descend,
+// the emails need not be in a range.
+		if (mif->seqno != f->start + j)
+			isrange = false;
+	}
+
+	idx = allocMem(f->nfetch * sizeof(int));
+	envCacheLoad(f, &ec);
+	same = (isrange && ec.modseq && f->modseq &&
+		ec.uidnext == f->uidnext && ec.nmsgs == f->nmsgs &&
+		ec.start == f->start && ec.nfetch == f->nfetch &&
+		ec.n == f->nfetch);
+	if (same) {
+		for (j = 0; j < f->nfetch; ++j)
+			envFromCache(f->mlist + j, ec.list + j, true);
+		if (ec.modseq == f->modseq) {
+			debugPrint(3, "envelopes of %s unchanged", f->path);
+			goto done;
+		}
+// messages were flagged, but none came or went
+		ignore = asprintf(&t, "FETCH %d:%d (UID FLAGS) (CHANGEDSINCE %llu)",
+		f->start, f->start + f->nfetch - 1, ec.modseq);
+		curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, t);
+		free(t);
+		res = getMailData(handle);
+		if (res != CURLE_OK) goto abort;
+		uidsAndFlags(f, true);
+		nzFree(mailstring), mailstring = 0;
+		debugPrint(3, "envelopes of %s from cache, flags refreshed", f->path);
+		goto done;
+	}
 
-		if(!t || !(t = strstr(t, "FETCH (UID "))) {
+// capture the uids and flags
+	for (j = 0; j < f->nfetch; ++j)
+		idx[j] = j;
+	set = seqnoSet(f, idx, f->nfetch);
+	ignore = asprintf(&t, "FETCH %s (UID FLAGS)", set);
+	nzFree(set);
+	curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, t);
+	free(t);
+	res = getMailData(handle);
+	if (res != CURLE_OK) goto abort;
+#if 0
+	FILE *z; z = fopen("ms1", "w"); fprintf(z, "%s", mailstring); fclose(z);
+#endif
+	uidsAndFlags(f, false);
+	nzFree(mailstring), mailstring = 0;
+
+	for (j = nmiss = 0; j < f->nfetch; ++j) {
+		mif = f->mlist + j;
+		if (!mif->uid)
 			printf("mail %d has no uid, operations will not work!", mif->seqno);
+		else if ((c = mifByUid(ec.list, ec.n, mif->uid))) {
+			envFromCache(mif, c, false);
 			continue;
 		}
-		t += 11;
-		while (*t == ' ') ++t;
-		if (isdigitByte(*t))
-			mif->uid = atoi(t);
-		else
-			printf("mail %d has no uid, operations will not work!", mif->seqno);
+		idx[nmiss++] = j;
 	}
-		nzFree(mailstring), mailstring = 0;
+	debugPrint(3, "envelopes of %s, %d from cache, %d from the server",
+	f->path, f->nfetch - nmiss, nmiss);
+	if (!nmiss)
+		goto done;
 
 // get envelopes
-	if(*imapLines) {
-		ignore = asprintf(&t, "FETCH %s ALL", imapLines);
-	} else {
-		sprintf(cust_cmd, "FETCH %d:%d ALL", f->start, f->start + f->nfetch - 1);
-		t = cust_cmd;
-	}
+	set = seqnoSet(f, idx, nmiss);
+	ignore = asprintf(&t, "FETCH %s ALL", set);
+	nzFree(set);
 	curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, t);
-	if(*imapLines) free(t);
+	free(t);
 
 /*********************************************************************
 Originally I used the WRITEFUNCTION to get the envelope data.
@@ -1562,7 +2093,8 @@ I have to use a stub function. You'll see below.
 	curl_easy_setopt(handle, CURLOPT_HEADERDATA, NULL);
 	if (res != CURLE_OK) {
 abort:
-		nzFree(imapLines);
+		nzFree(idx);
+		nzFree(ec.list);
 		ebcurl_setError(res, mailbox_url, (ismc ? 2 : 0), cerror);
 		nzFree(mailstring), mailstring = 0;
 		return false;
@@ -1576,11 +2108,13 @@ abort:
 	sfp = mailstring;
 	mailstring = 0;
 
-	for (j = 0; j < f->nfetch; ++j) {
-		mif = f->mlist + j;
+	for (j = 0; j < nmiss; ++j) {
+		mif = f->mlist + idx[j];
 		nfp = 0;
-		if(j < f->nfetch - 1) sprintf(nf, "* %d FETCH ", mif[1].seqno);
-		nfp = strstr(sfp, nf); // find next fetch
+		if(j < nmiss - 1) {
+			sprintf(nf, "* %d FETCH ", f->mlist[idx[j + 1]].seqno);
+			nfp = strstr(sfp, nf); // find next fetch
+		}
 		if(nfp) nfp[-1] = 0;
 
 /*********************************************************************
@@ -1719,8 +2253,6 @@ doflags:
 		t = u + 7;
 		if (strstr(t, "\\Seen"))
 			mif->seen = true;
-		else
-			++f->unread;
 
 dodate:
 		u = strstr(t, "INTERNALDATE ");
@@ -1749,7 +2281,14 @@ next_m:
 	sfp = nfp;
 	}
 
-	nzFree(imapLines); // in case it was a list
+done:
+	for (j = 0; j < f->nfetch; ++j)
+		if (!f->mlist[j].seen)
+			++f->unread;
+	if (isrange)
+		envCacheSave(f);
+	nzFree(idx);
+	nzFree(ec.list);
 	return true;
 }
 
@@ -1767,10 +2306,8 @@ static bool examineFolder(CURL * handle, struct FOLDER *f, bool dostats)
 
 /* interrogate folder */
 again:
-	ignore = asprintf(&t, "SELECT \"%s\"", f->path);
-	curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, t);
-	free(t);
-	res = getMailData(handle);
+// select even if selected, for fresh counts
+	res = selectFolder(handle, f->path, true, retry);
 	if (res != CURLE_OK) {
 		nzFree(mailstring), mailstring = 0;
 		if(!retry) { retry = true; goto again; }
@@ -1804,6 +2341,14 @@ again:
 			f->uidnext = atoi(t);
 	}
 
+	f->uidvalidity = 0, f->modseq = 0;
+	t = strstr(mailstring, "UIDVALIDITY ");
+	if (t)
+		f->uidvalidity = strtoul(t + 12, 0, 10);
+	t = strstr(mailstring, "HIGHESTMODSEQ ");
+	if (t)
+		f->modseq = strtoull(t + 14, 0, 10);
+
 	nzFree(mailstring);
 	if (dostats) {
 		if(!ismc) { // running within a buffer
@@ -1850,36 +2395,56 @@ again:
 	return true;
 }
 
-/* find the last mail in the local unread directory */
-static int unreadMax, unreadMin, unreadCount;
-static int unreadBase;		/* find min larger than base */
+/*********************************************************************
+Index of the local unread directory, the numbered files in ascending order.
+The directory is scanned once, when we start fetching or reading,
+and the list is kept up to date as messages are added.
+Reading through it used to rescan the directory for each message,
+which is quadratic, and slow indeed after a week away.
+*********************************************************************/
+
+static int *unreadList;
+static int unreadCount, unreadAlloc;
+static int unreadMax;		// highest file number, new mail goes above it
+
+static int unreadCmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x < y ? -1 : x > y);
+}
 
-static void unreadStats(void)
+static void unreadAppend(int n)
+{
+	if (unreadCount == unreadAlloc) {
+		unreadAlloc = (unreadAlloc ? unreadAlloc * 2 : 256);
+		unreadList = reallocMem(unreadList, unreadAlloc * sizeof(int));
+	}
+	unreadList[unreadCount++] = n;
+}
+
+static void unreadIndex(void)
 {
 	const char *f;
-	int n;
 
 	unreadMax = 0;
-	unreadMin = 0;
 	unreadCount = 0;
+	while ((f = nextScanFile(mailUnread)))
+		if (stringIsNum(f))
+			unreadAppend(atoi(f));
+	qsort(unreadList, unreadCount, sizeof(int), unreadCmp);
+	if (unreadCount)
+		unreadMax = unreadList[unreadCount - 1];
+}
 
-	while ((f = nextScanFile(mailUnread))) {
-		if (!stringIsNum(f))
-			continue;
-		n = atoi(f);
-		if (n > unreadMax)
-			unreadMax = n;
-		if (n > unreadBase) {
-			if (!unreadMin || n < unreadMin)
-				unreadMin = n;
-			++unreadCount;
-		}
-	}
+// number for the next message into unread, which goes on the end of the list
+static int unreadNext(void)
+{
+	unreadAppend(++unreadMax);
+	return unreadMax;
 }
 
 static char *umf;		/* unread mail file */
 static char *umf_end;
-static int umfd;		/* file descriptor for the above */
 /* convert mail message to/from utf8 if need be. */
 /* This isn't really right, cause it should be done per mime component. */
 static char *mailu8;
@@ -1942,24 +2507,19 @@ static CURLcode fetchOneMessage(CURL * handle, int message_number)
 
 	res = getMailData(handle);
 	undosOneMessage();
-	if (res != CURLE_OK)
-		return res;
-
-/* got the file, save it in unread */
-	sprintf(umf_end, "%d", unreadMax + message_number);
-	umfd = open(umf, O_WRONLY | O_TEXT | O_CREAT, MODE_rw);
-	if (umfd < 0)
-		i_printfExit(MSG_NoCreate, umf);
-	if (write(umfd, mailstring, mailstring_l) < mailstring_l)
-		i_printfExit(MSG_NoWrite, umf);
-	close(umfd);
-
 	return res;
 }
 
-static CURLcode deleteOneMessage(CURL * handle)
+static CURLcode deleteOneMessage(CURL * handle, int message_number)
 {
-	CURLcode res = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELE");
+	char *url = 0;
+	CURLcode res;
+	ignore = asprintf(&url, "%s%u", mailbox_url, message_number);
+	res = setCurlURL(handle, url);
+	free(url);
+	if (res != CURLE_OK)
+		return res;
+	res = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELE");
 	if (res != CURLE_OK)
 		return res;
 	res = curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
@@ -1969,6 +2529,95 @@ static CURLcode deleteOneMessage(CURL * handle)
 	return res;
 }
 
+/*********************************************************************
+Saving a message in unread, and syncing it to disk,
+overlaps with the retrieval of the next message.
+A message is deleted from the server only when it is safely on disk,
+so DELE for message n goes out after RETR for n+1,
+once the writer for n has finished.
+libcurl speaks pop3 one command at a time, and most servers lock the
+mailbox to one session, so we can't have several RETRs in flight,
+but this at least takes the disk off the critical path.
+*********************************************************************/
+
+static struct {
+	char *buf, *file;
+	int len;
+	int msg;		// message number on the server, 0 if nothing pending
+	int num;		// file number in unread
+	int err;		// 0, or the message to exit with
+	bool threaded;
+	pthread_t tid;
+} spool;
+
+/*********************************************************************
+The file is created exclusively. Another edbrowse, or another account
+being fetched alongside this one, may have taken this number
+since we indexed unread; if so, step past it to the next free number.
+*********************************************************************/
+
+static void *spoolWriter(void *ptr)
+{
+	int fd;
+	while ((fd = open(spool.file, O_WRONLY | O_TEXT | O_CREAT | O_EXCL,
+			  MODE_rw)) < 0 && errno == EEXIST)
+		sprintf(spool.file, "%s/%d", mailUnread, ++spool.num);
+	if (fd < 0) {
+		spool.err = MSG_NoCreate;
+		return NULL;
+	}
+	if (write(fd, spool.buf, spool.len) < spool.len)
+		spool.err = MSG_NoWrite;
+#ifndef _MSC_VER
+	else if (fsync(fd))
+		spool.err = MSG_NoWrite;
+#endif
+	close(fd);
+	return NULL;
+}
+
+// mailstring goes into unread/n, n being the next number in the index
+static void spoolStart(int message_number)
+{
+	spool.buf = mailstring, spool.len = mailstring_l;
+	mailstring = initString(&mailstring_l);
+	spool.num = unreadNext();
+	spool.file = allocMem(strlen(mailUnread) + 12);
+	sprintf(spool.file, "%s/%d", mailUnread, spool.num);
+	spool.msg = message_number;
+	spool.err = 0;
+	spool.threaded = !pthread_create(&spool.tid, NULL, spoolWriter, NULL);
+	if (!spool.threaded)
+		spoolWriter(NULL);
+}
+
+static void spoolWait(void)
+{
+	if (!spool.msg)
+		return;
+	if (spool.threaded)
+		pthread_join(spool.tid, NULL);
+	if (spool.err)
+		i_printfExit(spool.err, spool.file);
+// the writer may have moved on to a later number
+	if (spool.num > unreadMax)
+		unreadList[unreadCount - 1] = unreadMax = spool.num;
+	nzFree(spool.buf);
+	nzFree(spool.file);
+	spool.buf = spool.file = 0;
+}
+
+// wait for the pending message to reach the disk, then delete it on the server
+static CURLcode spoolFinish(CURL * handle)
+{
+	int n = spool.msg;
+	if (!n)
+		return CURLE_OK;
+	spoolWait();
+	spool.msg = 0;
+	return deleteOneMessage(handle, n);
+}
+
 static CURLcode count_messages(CURL * handle, int *message_count)
 {
 	CURLcode res = setCurlURL(handle, mailbox_url);
@@ -2100,6 +2749,8 @@ refresh:
 			ignore = asprintf(&w, "DELETE \"%s\"", t);
 			curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, w);
 			res = getMailData(handle);
+// the folder might have been the selected one
+			selForget(handle);
 			free(w);
 			nzFree(mailstring);
 			if (res != CURLE_OK) {
@@ -2126,6 +2777,8 @@ refresh:
 			ignore = asprintf(&w, "RENAME \"%s\" \"%s\"", t, u);
 			curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, w);
 			res = getMailData(handle);
+// the folder might have been the selected one
+			selForget(handle);
 			free(w);
 			nzFree(mailstring);
 			if (res != CURLE_OK) {
@@ -2183,13 +2836,7 @@ int fetchMail(int account)
 	if (chdir(mailDir))
 		i_printfExit(MSG_NoDirChange, mailDir);
 
-	if (!umf) {
-		umf = allocMem(strlen(mailUnread) + 12);
-		sprintf(umf, "%s/", mailUnread);
-		umf_end = umf + strlen(umf);
-	}
-	unreadBase = 0;
-	unreadStats();
+	unreadIndex();
 
 	mail_handle = newFetchmailHandle(login, pass);
 	res = count_messages(mail_handle, &message_count);
@@ -2201,17 +2848,26 @@ int fetchMail(int account)
 	     message_number++) {
 		ignore = asprintf(&message_url, "%s%u", mailbox_url, message_number);
 		res = fetchOneMessage(mail_handle, message_number);
-		if (res != CURLE_OK)
+		if (res != CURLE_OK) {
+// the previous message is ours, try to delete it as we would have before
+			spoolFinish(mail_handle);
 			goto fetchmail_cleanup;
+		}
 		nfetch++;
-		res = deleteOneMessage(mail_handle);
+// the previous message should be on disk by now
+		res = spoolFinish(mail_handle);
 		if (res != CURLE_OK)
 			goto fetchmail_cleanup;
+		spoolStart(message_number);
 		nzFree(message_url);
 		message_url = 0;
 	}
+	res = spoolFinish(mail_handle);
 
 fetchmail_cleanup:
+// If something went wrong, still save what we have, but don't delete it.
+	spoolWait();
+	spool.msg = 0;
 	if (message_url)
 		url_for_error = message_url;
 	if (res != CURLE_OK)
@@ -2225,12 +2881,34 @@ fetchmail_cleanup:
 	return nfetch;
 }
 
-/* fetch from all accounts except those with nofetch or imap set */
+/*********************************************************************
+Fetch from all accounts except those with nofetch or imap set.
+The accounts are separate servers, so there is no reason to wait for one
+before starting the next. fetchMail leans on a good deal of static state,
+the mailbox url, the curl callback buffer, the spool, the unread index,
+so rather than threads, each account is fetched in a child process,
+which reports its count back through a pipe.
+Children share the unread directory, and spoolWriter creates each file
+exclusively, so two accounts never write the same number.
+A child that fails, through i_printfExit, exits non-zero, and so do we,
+once the other accounts are in, as though we had fetched them in sequence.
+If we can't fork, fall back to fetching the accounts in sequence.
+*********************************************************************/
+
+struct FETCHKID {
+	int account;
+	int fd;
+	int pid;
+};
+
 int fetchAllMail(void)
 {
 	int i, j;
 	const struct MACCOUNT *a, *b;
-	int nfetch = 0;
+	int nfetch = 0, n, st;
+	struct FETCHKID *kids = allocZeroMem(maxAccount * sizeof(struct FETCHKID));
+	int nkids = 0;
+	bool failed = false;
 
 	for (i = 1; i <= maxAccount; ++i) {
 		a = accounts + i - 1;
@@ -2249,9 +2927,56 @@ int fetchAllMail(void)
 			continue;
 
 		debugPrint(3, "fetch from %d %s", i, a->inurl);
+#ifndef _MSC_VER
+		{
+			int pfd[2];
+			int pid;
+			if (!pipe(pfd)) {
+// don't let the child flush our pending output a second time
+				fflush(stdout);
+				pid = fork();
+				if (pid == 0) {
+					close(pfd[0]);
+					n = fetchMail(i);
+					fflush(stdout);
+					ignore = write(pfd[1], &n, sizeof(n));
+					_exit(0);
+				}
+				close(pfd[1]);
+				if (pid > 0) {
+					kids[nkids].account = i;
+					kids[nkids].fd = pfd[0];
+					kids[nkids].pid = pid;
+					++nkids;
+					continue;
+				}
+				close(pfd[0]);
+			}
+		}
+#endif
 		nfetch += fetchMail(i);
 	}
 
+#ifndef _MSC_VER
+// collect the counts in account order; the slowest server sets the pace
+	for (j = 0; j < nkids; ++j) {
+		if (read(kids[j].fd, &n, sizeof(n)) != sizeof(n))
+			n = 0;
+		close(kids[j].fd);
+		if (waitpid(kids[j].pid, &st, 0) != kids[j].pid ||
+		    !WIFEXITED(st) || WEXITSTATUS(st)) {
+			debugPrint(3, "account %d status %d", kids[j].account, st);
+			i_printf(MSG_AccountFailed, kids[j].account);
+			failed = true;
+		} else if (debugLevel >= 1)
+			i_printf(MSG_AccountMessages, kids[j].account, n);
+		nfetch += n;
+	}
+#endif
+
+	nzFree(kids);
+	if (failed)
+		ebClose(99);
 	return nfetch;
 }
 
@@ -2273,39 +2998,514 @@ void scanUnreadMail(void)
 	if (chdir(mailDir))
 		i_printfExit(MSG_NoDirChange, mailDir);
 
-	if (!umf) {
-		umf = allocMem(strlen(mailUnread) + 12);
-		sprintf(umf, "%s/", mailUnread);
-		umf_end = umf + strlen(umf);
+	if (!umf) {
+		umf = allocMem(strlen(mailUnread) + 12);
+		sprintf(umf, "%s/", mailUnread);
+		umf_end = umf + strlen(umf);
+	}
+
+/* How many mail messages? */
+	unreadIndex();
+	nmsgs = unreadCount;
+	if (!nmsgs) {
+		i_puts(MSG_NoMail);
+		exit(0);
+	}
+	i_printf(MSG_MessagesX, nmsgs);
+
+	for (m = 0; m < nmsgs; ++m) {
+		sprintf(umf_end, "%d", unreadList[m]);
+// gone already? Perhaps another edbrowse is working through the same mail.
+		if (!fileTypeByName(umf, 0))
+			continue;
+// Now grab the entire message
+		if (!fileIntoMemory(umf, &mailstring, &mailstring_l, 0))
+			showErrorAbort();
+
+		key = presentMail(&plain);
+		if(key == 'g') { --m; continue; }
+		if(key == 't') { plain ^= 1; --m; continue; }
+		if (key == 'd')
+			unlink(umf);
+		plain = false;
+	}			// loop over mail messages
+
+	exit(0);
+}
+
+/*********************************************************************
+A local index of the mail you save, so you can find a letter among
+years of saved folders without opening them one by one,
+or asking the imap server, which only searches one folder at a time.
+Formatted mail is indexed as it is saved, and that includes the
+unread spool as you read it, since it is saved the same way.
+mindex file indexes a folder that was saved before the index was there.
+mfind words lists the letters that contain all those words, in a new buffer.
+The index lives in $cacheDir/mailindex.
+docs has a line per letter: file offset date from subject, tab separated,
+and the byte offset of that line is the document number.
+Words are spread over MIXBUCKETS files by hash, a line per word and document,
+so a query reads only the buckets of its words, not the mail.
+Everything is appended, nothing is rewritten. If a folder is edited
+or removed, its stale entries are passed over when you search.
+*********************************************************************/
+
+#define MIXBUCKETS 256
+#define MIXWORDMAX 40
+
+static const char mailSeparator[] =
+"======================================================================\n";
+#define MAILSEPLEN 71
+
+static char *mixDir(void)
+{
+	static bool tried;
+	char *dir;
+
+	if (!cacheDir && !tried) {
+		tried = true;
+		setupEdbrowseCache();
+	}
+	if (!cacheDir)
+		return 0;
+	ignore = asprintf(&dir, "%s/mailindex", cacheDir);
+	if (fileTypeByName(dir, 0) != 'd' && mkdir(dir, 0700)) {
+		free(dir);
+		return 0;
+	}
+	return dir;
+}
+
+static char *mixBucket(const char *dir, int h)
+{
+	char *file;
+	ignore = asprintf(&file, "%s/%02x", dir, h);
+	return file;
+}
+
+static int mixHash(const char *word)
+{
+	return hashBytes(word, strlen(word)) % MIXBUCKETS;
+}
+
+// Length of the word character at s, or 0 if it separates words.
+// Letters and digits, and anything beyond ascii except the latin1
+// punctuation and the general punctuation block, curly quotes and dashes.
+static int mixChar(const uchar *s, const uchar *end)
+{
+	uchar c = *s;
+	int j, l;
+	if (c < 0x80)
+		return isalnumByte(c) ? 1 : 0;
+	if (c >= 0xf0) l = 4;
+	else if (c >= 0xe0) l = 3;
+	else if (c >= 0xc0) l = 2;
+	else return 0;
+	if (s + l > end)
+		return 0;
+	for (j = 1; j < l; ++j)
+		if ((s[j] & 0xc0) != 0x80)
+			return 0;
+	if (c == 0xc2 && s[1] < 0xc0)
+		return 0;
+	if (c == 0xe2 && (s[1] == 0x80 || s[1] == 0x81))
+		return 0;
+	return l;
+}
+
+static int mixWordCompare(const void *s, const void *t)
+{
+	return strcmp(*(char *const *)s, *(char *const *)t);
+}
+
+// the distinct words of the text, lower case, sorted
+static char **mixWords(const char *text, int len, int *n_p)
+{
+	const uchar *s = (const uchar *)text, *end = s + len, *w;
+	int n = 0, room = 64, j, k, l;
+	char **list = allocMem(room * sizeof(char *));
+
+	while (s < end) {
+		if (!(l = mixChar(s, end))) {
+			++s;
+			continue;
+		}
+		for (w = s; s < end && (l = mixChar(s, end)); s += l) ;
+		if (s - w < 2 || s - w > MIXWORDMAX)
+			continue;
+		if (n == room) {
+			room *= 2;
+			list = reallocMem(list, room * sizeof(char *));
+		}
+		list[n] = pullString((char *)w, s - w);
+		caseShift(list[n], 'l');
+		++n;
+	}
+
+	if (n)
+		qsort(list, n, sizeof(char *), mixWordCompare);
+	for (j = k = 0; j < n; ++j) {
+		if (k && stringEqual(list[j], list[k - 1])) {
+			nzFree(list[j]);
+			continue;
+		}
+		list[k++] = list[j];
+	}
+	*n_p = k;
+	return list;
+}
+
+static void mixWordsFree(char **list, int n)
+{
+	int j;
+	for (j = 0; j < n; ++j)
+		nzFree(list[j]);
+	nzFree(list);
+}
+
+// copy a header field into the docs record, no tabs or newlines
+static void mixField(char **rp, int *lp, const char *s, const char *end)
+{
+	for (; s < end && *s != '\n'; ++s)
+		stringAndChar(rp, lp, (*s == '\t' || *s == '\r') ? ' ' : *s);
+	stringAndChar(rp, lp, '\t');
+}
+
+// index a letter, formatted, that sits at offset in file
+static void mixAdd(const char *file, long long offset, const char *text, int len)
+{
+	char *dir, *path, *rec, *t;
+	char *buckets[MIXBUCKETS];
+	int bucket_l[MIXBUCKETS];
+	const char *subject = 0, *from = 0, *date = 0, *s, *e, *end = text + len;
+	char **words;
+	int j, nw, fh, rec_l;
+	long long docid;
+	char cwdbuf[ABSPATH], num[24];
+
+	if (!(dir = mixDir()))
+		return;
+
+// the header lines are at the top, up to the first empty line
+	for (s = text; s < end && *s != '\n'; s = e + 1) {
+		if (!(e = memchr(s, '\n', end - s)))
+			e = end;
+		if (!subject && !strncmp(s, "Subject: ", 9))
+			subject = s + 9;
+		if (!from && !strncmp(s, "From ", 5))
+			from = s + 5;
+		if (!date && !strncmp(s, "Mail sent ", 10))
+			date = s + 10;
+		if (e == end)
+			break;
+	}
+
+	rec = initString(&rec_l);
+	if (file[0] != '/' && getcwd(cwdbuf, sizeof(cwdbuf))) {
+		stringAndString(&rec, &rec_l, cwdbuf);
+		stringAndChar(&rec, &rec_l, '/');
+	}
+	mixField(&rec, &rec_l, file, file + strlen(file));
+	sprintf(num, "%lld", offset);
+	mixField(&rec, &rec_l, num, num + strlen(num));
+	mixField(&rec, &rec_l, date, date ? end : date);
+	mixField(&rec, &rec_l, from, from ? end : from);
+	mixField(&rec, &rec_l, subject, subject ? end : subject);
+	rec[rec_l - 1] = '\n';
+
+	ignore = asprintf(&path, "%s/docs", dir);
+	fh = open(path, O_WRONLY | O_CREAT | O_APPEND | O_BINARY, MODE_private);
+	free(path);
+	if (fh < 0) {
+		nzFree(rec);
+		free(dir);
+		return;
+	}
+	docid = lseek(fh, 0, SEEK_END);
+	j = write(fh, rec, rec_l);
+	close(fh);
+	nzFree(rec);
+	if (docid < 0 || j < rec_l) {
+		free(dir);
+		return;
+	}
+
+// gather the postings by bucket, so each bucket is opened once
+	memset(buckets, 0, sizeof(buckets));
+	sprintf(num, " %lld\n", docid);
+	words = mixWords(text, len, &nw);
+	for (j = 0; j < nw; ++j) {
+		int h = mixHash(words[j]);
+		if (!buckets[h])
+			buckets[h] = initString(bucket_l + h);
+		stringAndString(buckets + h, bucket_l + h, words[j]);
+		stringAndString(buckets + h, bucket_l + h, num);
+	}
+	mixWordsFree(words, nw);
+
+	for (j = 0; j < MIXBUCKETS; ++j) {
+		if (!(t = buckets[j]))
+			continue;
+		path = mixBucket(dir, j);
+		fh = open(path, O_WRONLY | O_CREAT | O_APPEND | O_BINARY, MODE_private);
+		if (fh >= 0) {
+			ignore = write(fh, t, bucket_l[j]);
+			close(fh);
+		}
+		free(path);
+		nzFree(t);
+	}
+	free(dir);
+	debugPrint(4, "mail index %s %lld, %d words", file, offset, nw);
+}
+
+static int mixIdCompare(const void *s, const void *t)
+{
+	long long a = *(const long long *)s, b = *(const long long *)t;
+	return a < b ? -1 : a > b;
+}
+
+// documents that contain word, sorted, no duplicates
+static long long *mixPostings(const char *dir, const char *word, int *n_p)
+{
+	char *file, *data, *s, *e, *end;
+	int len, n = 0, room = 32, j, k, wl = strlen(word);
+	long long *ids = allocMem(room * sizeof(long long));
+
+	*n_p = 0;
+	file = mixBucket(dir, mixHash(word));
+	if (fileTypeByName(file, 0) != 'f' ||
+	    !fileIntoMemory(file, &data, &len, 0)) {
+		free(file);
+		return ids;
+	}
+	free(file);
+	end = data + len;
+	for (s = data; s < end; s = e + 1) {
+		if (!(e = memchr(s, '\n', end - s)))
+			break;
+		if (e - s <= wl || s[wl] != ' ' || memcmp(s, word, wl))
+			continue;
+		if (n == room) {
+			room *= 2;
+			ids = reallocMem(ids, room * sizeof(long long));
+		}
+		ids[n++] = strtoll(s + wl + 1, 0, 10);
+	}
+	nzFree(data);
+
+	if (n)
+		qsort(ids, n, sizeof(long long), mixIdCompare);
+	for (j = k = 0; j < n; ++j)
+		if (!k || ids[j] != ids[k - 1])
+			ids[k++] = ids[j];
+	*n_p = k;
+	return ids;
+}
+
+struct MIXHIT {
+	long long docid, offset;
+	char *file, *date, *from, *subject;	// point into the docs file
+	int line;
+};
+
+static int mixHitByFile(const void *s, const void *t)
+{
+	const struct MIXHIT *a = s, *b = t;
+	int d = strcmp(a->file, b->file);
+	if (d)
+		return d;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+// the same letter indexed twice, keep the newer entry
+	return a->docid > b->docid ? -1 : a->docid < b->docid;
+}
+
+static int mixHitByDoc(const void *s, const void *t)
+{
+	const struct MIXHIT *a = s, *b = t;
+	return a->docid > b->docid ? -1 : a->docid < b->docid;
+}
+
+// Find the line numbers of the hits in one file, and drop the hits
+// that no longer start a letter, because the file has been edited.
+static void mixLines(struct MIXHIT *h, int n)
+{
+	char *data = 0, *s;
+	int len = 0, j, line = 1;
+	long long at = 0;
+
+	if (fileTypeByName(h->file, 0) != 'f' ||
+	    !fileIntoMemory(h->file, &data, &len, 0))
+		len = 0, data = 0;
+	s = data;
+	for (j = 0; j < n; ++j) {
+		long long o = h[j].offset;
+		h[j].line = 0;
+		if (o >= len || o < 0 ||
+		    (o && (o < MAILSEPLEN ||
+			   memcmp(data + o - MAILSEPLEN, mailSeparator, MAILSEPLEN))))
+			continue;
+		for (; at < o; ++at)
+			if (s[at] == '\n')
+				++line;
+		h[j].line = line;
+	}
+	nzFree(data);
+}
+
+// Returns the search results as text, a line per letter, newest first.
+char *mailSearch(const char *query, int *len_p)
+{
+	char **words, *dir, *path, *docs, *s, *t, *out;
+	long long *ids = 0, *p;
+	int nw, n = 0, np, j, k, docs_l, out_l;
+	struct MIXHIT *hits;
+
+	words = mixWords(query, strlen(query), &nw);
+	if (!nw) {
+		nzFree(words);
+		setError(MSG_NoSearchString);
+		return 0;
+	}
+	if (!(dir = mixDir())) {
+		mixWordsFree(words, nw);
+		setError(MSG_NoAccess, "$cacheDir/mailindex");
+		return 0;
+	}
+
+// intersect the postings of each word
+	for (j = 0; j < nw; ++j) {
+		p = mixPostings(dir, words[j], &np);
+		if (!j) {
+			ids = p, n = np;
+		} else {
+			int a = 0, b = 0, c = 0;
+			while (a < n && b < np) {
+				if (ids[a] < p[b]) ++a;
+				else if (ids[a] > p[b]) ++b;
+				else ids[c++] = ids[a], ++a, ++b;
+			}
+			n = c;
+			nzFree(p);
+		}
+		if (!n)
+			break;
+	}
+	mixWordsFree(words, nw);
+	if (!n) {
+		nzFree(ids);
+		free(dir);
+		setError(MSG_NoMatch);
+		return 0;
 	}
 
-/* How many mail messages? */
-	unreadBase = 0;
-	unreadStats();
-	nmsgs = unreadCount;
-	if (!nmsgs) {
-		i_puts(MSG_NoMail);
-		exit(0);
+	ignore = asprintf(&path, "%s/docs", dir);
+	free(dir);
+	if (!fileIntoMemory(path, &docs, &docs_l, 0)) {
+		free(path);
+		nzFree(ids);
+		return 0;
 	}
-	i_printf(MSG_MessagesX, nmsgs);
+	free(path);
+
+// each document number must start a record, check them all
+// before the records are split apart in place
+	for (j = k = 0; j < n; ++j)
+		if (ids[j] < docs_l && (!ids[j] || docs[ids[j] - 1] == '\n'))
+			ids[k++] = ids[j];
+	n = k;
+	hits = allocZeroMem(n * sizeof(struct MIXHIT) + 1);
+	for (j = k = 0; j < n; ++j) {
+		char *f[5];
+		int m;
+		s = docs + ids[j];
+		for (m = 0; m < 5; ++m) {
+			f[m] = s;
+			t = s + strcspn(s, "\t\n");
+			if (!*t || (*t == '\n' && m < 4))
+				break;
+			*t = 0, s = t + 1;
+		}
+		if (m < 5)
+			continue;
+		hits[k].docid = ids[j];
+		hits[k].file = f[0];
+		hits[k].offset = strtoll(f[1], 0, 10);
+		hits[k].date = f[2];
+		hits[k].from = f[3];
+		hits[k].subject = f[4];
+		++k;
+	}
+	n = k;
+	nzFree(ids);
+
+// by file, to drop duplicates and read each file once
+	qsort(hits, n, sizeof(struct MIXHIT), mixHitByFile);
+	for (j = k = 0; j < n; ++j) {
+		if (k && stringEqual(hits[j].file, hits[k - 1].file) &&
+		    hits[j].offset == hits[k - 1].offset)
+			continue;
+		hits[k++] = hits[j];
+	}
+	n = k;
+	for (j = 0; j < n; j = k) {
+		for (k = j + 1; k < n && stringEqual(hits[k].file, hits[j].file); ++k) ;
+		mixLines(hits + j, k - j);
+	}
+	qsort(hits, n, sizeof(struct MIXHIT), mixHitByDoc);
 
-	for (m = 1; m <= nmsgs; ++m) {
-// Now grab the entire message
-		unreadStats();
-		sprintf(umf_end, "%d", unreadMin);
-		if (!fileIntoMemory(umf, &mailstring, &mailstring_l, 0))
-			showErrorAbort();
-		unreadBase = unreadMin;
+	out = initString(&out_l);
+	for (j = 0; j < n; ++j) {
+		struct MIXHIT *h = hits + j;
+		if (!h->line)
+			continue;
+		stringAndString(&out, &out_l, (*h->subject ? h->subject : "no subject"));
+		stringAndString(&out, &out_l, " | ");
+		stringAndString(&out, &out_l, h->from);
+		stringAndString(&out, &out_l, " | ");
+		stringAndString(&out, &out_l, h->date);
+		stringAndString(&out, &out_l, " | ");
+		stringAndString(&out, &out_l, h->file);
+		stringAndChar(&out, &out_l, ':');
+		stringAndNum(&out, &out_l, h->line);
+		stringAndChar(&out, &out_l, '\n');
+	}
+	nzFree(hits);
+	nzFree(docs);
+	if (!out_l) {
+		nzFree(out);
+		setError(MSG_NoMatch);
+		return 0;
+	}
+	*len_p = out_l;
+	return out;
+}
 
-		key = presentMail(&plain);
-		if(key == 'g') { --m, --unreadBase; continue; }
-		if(key == 't') { plain ^= 1; --m, --unreadBase; continue; }
-		if (key == 'd')
-			unlink(umf);
-		plain = false;
-	}			// loop over mail messages
+// Index the letters in a folder that was saved before the index.
+bool mailIndexFile(const char *file)
+{
+	char *data, *s, *e, *end;
+	int len, n = 0;
 
-	exit(0);
+	if (!fileIntoMemory(file, &data, &len, 0))
+		return false;
+	end = data + len;
+	for (s = data; s < end; s = e + MAILSEPLEN) {
+		for (e = s; (e = memmem(e, end - e, mailSeparator, MAILSEPLEN)); ++e)
+			if (e == data || e[-1] == '\n')
+				break;
+		if (!e)
+			e = end;
+		if (e > s)
+			mixAdd(file, s - data, s, e - s), ++n;
+		if (e == end)
+			break;
+	}
+	nzFree(data);
+	if (debugLevel >= 1)
+		i_printf(MSG_MessagesX, n);
+	return true;
 }
 
 // this doesn't print error messages if anything goes wrong; it probably should
@@ -2352,22 +3552,31 @@ static void saveRawMail(const char *buf, int length)
 }
 
 // this writes from the current window.
-// receives a file handle, file is already open.
+// receives a file handle, file is already open, and its name for the index.
 // It's unix-like, so return size of the write, or -1 for error
-static int saveFormattedMail(int fh)
+static int saveFormattedMail(int fh, const char *name)
 {
 	int j, k;
 	int fsize = 0;
+	char *text;
+	int text_l;
+	off_t offset = lseek(fh, 0, SEEK_END);
+	text = initString(&text_l);
 	for (j = 1; j <= cw->dol; ++j) {
 		char *showline = (char *)fetchLine(j, 1);
 		int len = pstLength((pst)showline);
 		if (write(fh, showline, len) < len) {
 			nzFree(showline);
+			nzFree(text);
 			return -1;
 		}
+		stringAndBytes(&text, &text_l, showline, len);
 		nzFree(showline);
 		fsize += len;
 	}
+	if (offset >= 0)
+		mixAdd(name, offset, text, text_l);
+	nzFree(text);
 
 	if (stashNumber >= 0) {
 		char addstash[60];
@@ -2586,7 +3795,7 @@ badsave:
 
 // key = w, write the file and save the original unformatted
 		saveRawMail(mailstring, mailstring_l);
-		fsize = saveFormattedMail(fh);
+		fsize = saveFormattedMail(fh, atname);
 		if(fsize < 0) goto badsave;
 		close(fh);
 
@@ -2726,27 +3935,8 @@ void mail64Error(int err)
 
 static void unpackQP(struct MHINFO *w)
 {
-	char c, d, *q, *r;
-	for (q = r = w->start; q < w->end; ++q) {
-		c = *q;
-		if (c != '=') { *r++ = c; continue; }
-		c = *++q;
-		if (c == '\n')
-			continue;
-		d = q[1];
-		if (isxdigit(c) && isxdigit(d)) {
-			d = fromHex(c, d);
-			if (d == 0)
-				d = ' ';
-			*r++ = d;
-			++q;
-			continue;
-		}
-		--q;
-		*r++ = '=';
-	}
-	w->end = r;
-	*r = 0;
+	w->end = qpDecode(w->start, w->end);
+	*w->end = 0;
 }
 
 /* Look for the name of the attachment and boundary */
@@ -2974,6 +4164,97 @@ static void extractLessGreater(char *s)
 	}
 }
 
+/*********************************************************************
+A large attachment is written out to the temp directory once it is decoded,
+and the mail links to that file.
+As a data: url it was encoded in base64 all over again,
+and that string rode along in the formatted mail, the html tree,
+and the href of the anchor, each a copy bigger than the attachment.
+The files belong to the buffer that shows the mail,
+and are removed when that buffer is freed, or the mail is browsed again.
+Whatever is left when edbrowse exits is removed then.
+The whole message is still in memory, as it came from the server;
+only the decoded copies are spared.
+*********************************************************************/
+
+#define MAILSPILL (256*1024)
+static int spillCount, spillPid;
+
+// remove the attachment files of a buffer
+void mailSpillFree(Window *w)
+{
+	char *s, *t;
+	if (!w->mailSpill)
+		return;
+	for (s = w->mailSpill; (t = strchr(s, '\n')); s = t + 1) {
+		*t = 0;
+		unlink(s);
+	}
+	nzFree(w->mailSpill);
+	w->mailSpill = 0;
+}
+
+static void spillClean(void)
+{
+	int cx;
+	Window *w;
+// a forked child that exits must not take the parent's files with it
+	if (getpid() != spillPid)
+		return;
+	for (cx = 1; cx <= maxSession; ++cx)
+		for (w = sessionList[cx].lw; w; w = w->prev)
+			mailSpillFree(w);
+	if (cw)
+		mailSpillFree(cw);
+}
+
+static void spillAttachment(struct MHINFO *w)
+{
+	char suffix[12], *name;
+	const char *q;
+	int fh, j, l, nb = w->end - w->start;
+
+	if (nb < MAILSPILL || !ebUserDir)
+		return;
+// the suffix lets plugins find the attachment when you follow the link
+	suffix[0] = 0;
+	if ((q = strrchr(w->cfn, '.'))) {
+		for (j = 1; isalnumByte(q[j]) && j < 10; ++j) ;
+		if (j > 1 && !q[j])
+			strcpy(suffix, q);
+	}
+	if (asprintf(&name, "%s/att%d-%d%s",
+		     ebUserDir, getpid(), spillCount, suffix) < 0)
+		i_printfExit(MSG_MemAllocError, strlen(ebUserDir) + 24);
+	fh = open(name, O_WRONLY | O_BINARY | O_CREAT | O_TRUNC, MODE_private);
+	if (fh < 0) {
+		debugPrint(3, "cannot create %s", name);
+		free(name);
+		return;
+	}
+	if (write(fh, w->start, nb) < nb) {
+		debugPrint(3, "cannot write %s", name);
+		close(fh);
+		unlink(name);
+		free(name);
+		return;
+	}
+	close(fh);
+	if (!spillPid) {
+		spillPid = getpid();
+		atexit(spillClean);
+	}
+	++spillCount;
+	if (cw->mailSpill)
+		l = strlen(cw->mailSpill);
+	else
+		cw->mailSpill = initString(&l);
+	stringAndString(&cw->mailSpill, &l, name);
+	stringAndChar(&cw->mailSpill, &l, '\n');
+	w->spill = name;
+	debugPrint(3, "attachment %d bytes to %s", nb, name);
+}
+
 /* Now that we know it's mail, see what information we can
  * glean from the headers.
  * Returns a pointer to an allocated MHINFO structure.
@@ -3313,6 +4594,9 @@ static struct MHINFO *headerGlean(char *start, char *end, bool top)
 				firstAttach = w->cfn;
 		}
 		debugPrint(5, "attach %d%s", nattach, (w->atimage ? "i" : ""));
+// text that isn't encoded is shown in line, see formatMail
+		if (w->ct != CT_TEXT || w->ce > CE_8BIT)
+			spillAttachment(w);
 		return w;
 	}
 
@@ -3717,6 +5001,8 @@ static void formatMail(struct MHINFO *w, bool top)
 char *emailParse(char *buf, bool plain)
 {
 	struct MHINFO *w;
+// the attachments of the last browse of this buffer go
+	mailSpillFree(cw);
 	nattach = nimages = 0;
 	preferPlain = plain;
 	firstAttach = 0;
@@ -4338,7 +5624,6 @@ bool folderSearch(const char *path, char *search, bool rf)
 	struct MACCOUNT *a = accounts + act - 1;
 	Window *w;
 	const char *t = search;
-	char *u;
 	bool unseen = false, retry = false;
 
 	if(*t == 'u') ++t, unseen = true;
@@ -4362,15 +5647,15 @@ bool folderSearch(const char *path, char *search, bool rf)
 
 	active_a = a, isimap = true;
 	curl_easy_setopt(h, CURLOPT_VERBOSE, (debugLevel >= 4));
-// We have to select the folder first, then search
-// Technically we don't have to on refresh, but I will anyways,
-// in case it's been a long time and we logged out and need to reselect.
+// We have to select the folder first, then search.
+// If it's been a long time and we logged out, the search fails,
+// and we select again and retry.
 	if(rf) path = cw->baseDirName;
+	struct FOLDER f0;
+	memset(&f0, 0, sizeof(f0));
+	f0.path = path;
 again:
-	ignore = asprintf(&u, "SELECT \"%s\"", path);
-	curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, u);
-	free(u);
-	res = getMailData(h);
+	res = selectFolder(h, path, retry, retry);
 	nzFree(mailstring), mailstring = 0;
 	if(res != CURLE_OK) {
 		if(!retry) { retry = true; goto again; }
@@ -4378,11 +5663,9 @@ again:
 		return false;
 	}
 
-	struct FOLDER f0;
-	memset(&f0, 0, sizeof(f0));
-	f0.path = path;
 	if(imapSearch(h, &f0, search + unseen, unseen, &res) <= 0) {
 		cleanFolder(&f0);
+		if(res != CURLE_OK && !retry) { retry = true; goto again; }
 		if(res != CURLE_OK)
 			ebcurl_setError(res, cf->firstURL, 0, cerror);
 		return false;
@@ -4549,16 +5832,25 @@ bool mailDescend(const char *title, char cmd)
 	return true;
 }
 
+// uids of the messages on lines l1 through l2 of the folder buffer, sorted
+static int *rangeUids(int l1, int l2)
+{
+	int *uids = allocMem((l2 - l1 + 1) * sizeof(int));
+	int j;
+	for (j = 0; l1 <= l2; ++l1)
+		uids[j++] = atoi((char*)cw->r_map[l1].text);
+	qsort(uids, j, sizeof(int), uidCompare);
+	return uids;
+}
+
 bool imapMovecopy(int l1, int l2, char cmd, char *dest)
 {
-	CURLcode res;
 	CURL *h = cw->imap_h;
 	int act = cw->imap_n;
 	const char *path;
 	const Window *pw = cw->prev; // previous
 	struct MACCOUNT *a = accounts + act - 1;
-	int l0;
-	char cust_cmd[80];
+	int *uids, n = l2 - l1 + 1;
 	bool rc;
 
 	if(!l1) {
@@ -4580,62 +5872,25 @@ baddest:
 		goto baddest;
 	}
 
-	imapLines = initString(&iml_l);
-	sprintf(cust_cmd, "UID %s ",
-	     ((a->move_capable && cmd == 'm') ? "MOVE" : "COPY"));
-	stringAndString(&imapLines, &iml_l, cust_cmd);
-// loop over lines in range, is there a limit to the length of the resulting
-// imap line, with its comma separated list of uids?
-	for(l0 = l1; l1 <= l2; ++l1) {
-		const char *title = (char*)cw->r_map[l1].text;
-		int uid = atoi(title);
-		stringAndNum(&imapLines, &iml_l, uid);
-		stringAndChar(&imapLines, &iml_l, (l1 < l2 ? ',' : ' '));
-	}
-	stringAndChar(&imapLines, &iml_l, '"');
-	stringAndString(&imapLines, &iml_l, path);
-	stringAndChar(&imapLines, &iml_l, '"');
-
-	rc = tryTwice(h, cw->baseDirName, imapLines);
-	nzFree(imapLines), imapLines = 0;
-	if(!rc) return false;
-
-	if(cmd == 'm' && !a->move_capable) {
+	uids = rangeUids(l1, l2);
+	rc = uidMovecopy(h, cw->baseDirName, uids, n, (cmd == 'm'), path);
 // move is copy + delete, this is the delete part.
-// You'll see it again in the next function.
-		imapLines = initString(&iml_l);
-		stringAndString(&imapLines, &iml_l, "uid STORE ");
-		for(l1 = l0; l1 <= l2; ++l1) {
-			const char *title = (char*)cw->r_map[l1].text;
-			int uid = atoi(title);
-			stringAndNum(&imapLines, &iml_l, uid);
-			stringAndChar(&imapLines, &iml_l, (l1 < l2 ? ',' : ' '));
-		}
-		stringAndString(&imapLines, &iml_l, "+Flags \\Deleted");
-// I don't do the retry here; we just succeeded above so we should be ok.
-		curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, imapLines);
-		nzFree(imapLines), imapLines = 0;
-		res = getMailData(h);
-		nzFree(mailstring), mailstring = 0;
-		if (res != CURLE_OK) {
-			ebcurl_setError(res, cf->firstURL, 0, cerror);
-			return false;
-		}
-	expunge(h);
-	}
+	if(rc && cmd == 'm' && !a->move_capable)
+		rc = uidDelete(h, cw->baseDirName, uids, n);
+	nzFree(uids);
+	if(!rc) return false;
 
 	if(cmd == 'm')
-		delText(l0, l2);
+		delText(l1, l2);
 	return true;
 }
 
 bool imapDelete(int l1, int l2, char cmd)
 {
-	CURLcode res;
 	CURL *h = cw->imap_h;
 	int act = cw->imap_n;
 	struct MACCOUNT *a = accounts + act - 1;
-	int l0;
+	int *uids;
 	bool rc;
 
 	if(!l1) {
@@ -4655,23 +5910,11 @@ bool imapDelete(int l1, int l2, char cmd)
 		goto D_check;
 	}
 
-	imapLines = initString(&iml_l);
-	stringAndString(&imapLines, &iml_l, "uid STORE ");
-// loop over lines in range, is there a limit to the length of the resulting
-// imap line, with its comma separated list of uids?
-	for(l0 = l1; l1 <= l2; ++l1) {
-		const char *title = (char*)cw->r_map[l1].text;
-		int uid = atoi(title);
-		stringAndNum(&imapLines, &iml_l, uid);
-		stringAndChar(&imapLines, &iml_l, (l1 < l2 ? ',' : ' '));
-	}
-	stringAndString(&imapLines, &iml_l, "+Flags \\Deleted");
-
-	rc = tryTwice(h, cw->baseDirName, imapLines);
-	nzFree(imapLines), imapLines = 0;
+	uids = rangeUids(l1, l2);
+	rc = uidDelete(h, cw->baseDirName, uids, l2 - l1 + 1);
+	nzFree(uids);
 	if(!rc) return false;
-	expunge(h);
-	delText(l0, l2);
+	delText(l1, l2);
 
 D_check:
 	if(cmd == 'D') printDot();
@@ -4680,11 +5923,8 @@ D_check:
 
 bool imapMarkRead(int l1, int l2, char sign)
 {
-	CURLcode res;
 	CURL *h = cw->imap_h;
-	int act = cw->imap_n;
-	struct MACCOUNT *a = accounts + act - 1;
-	int l0;
+	int *uids;
 	bool rc;
 
 	if(!l1) {
@@ -4693,31 +5933,20 @@ bool imapMarkRead(int l1, int l2, char sign)
 	}
 
 	if(sign == 0) sign = '+';
-	imapLines = initString(&iml_l);
-	stringAndString(&imapLines, &iml_l, "uid STORE ");
-// loop over lines in range, is there a limit to the length of the resulting
-// imap line, with its comma separated list of uids?
-	for(l0 = l1; l1 <= l2; ++l1) {
-		const char *title = (char*)cw->r_map[l1].text;
-		int uid = atoi(title);
-		stringAndNum(&imapLines, &iml_l, uid);
-		stringAndChar(&imapLines, &iml_l, (l1 < l2 ? ',' : ' '));
-	}
-	stringAndChar(&imapLines, &iml_l, sign);
-	stringAndString(&imapLines, &iml_l, "Flags \\Seen");
-
-	rc = tryTwice(h, cw->baseDirName, imapLines);
-	nzFree(imapLines), imapLines = 0;
+	uids = rangeUids(l1, l2);
+	rc = uidCommand(h, cw->baseDirName, "STORE", uids, l2 - l1 + 1,
+	(sign == '+' ? "+FLAGS.SILENT (\\Seen)" : "-FLAGS.SILENT (\\Seen)"));
+	nzFree(uids);
 	if(!rc) return false;
 
-	for(l1 = l0; l1 <= l2; ++l1)
+// the stars are in our buffer, nothing more goes to the server
+	for(; l1 <= l2; ++l1)
 		if(sign == '+') unstar(l1); else restar(l1);
 	return true;
 }
 
 bool imapMovecopyWhileReading(char cmd, char *dest)
 {
-	CURLcode res;
 	const Window *pw = cw->prev;
 	const Window *pw2 = pw->prev;
 	int uid = cw->imap_n;
@@ -4725,9 +5954,7 @@ bool imapMovecopyWhileReading(char cmd, char *dest)
 	int act = pw->imap_n;
 	struct MACCOUNT *a = accounts + act - 1;
 	const char *path;
-	char *t;
 	bool rc;
-	char cust_cmd[80];
 
 	skipWhite2(&dest);
 	if(!*dest) { // nothing there
@@ -4743,23 +5970,11 @@ baddest:
 		goto baddest;
 	}
 
-	ignore = asprintf(&t, "UID %s %d \"%s\"", 	     ((a->move_capable && cmd == 'm') ? "MOVE" : "COPY"), uid, path);
-	rc = tryTwice(h, pw->baseDirName, t);
-	nzFree(t), t = 0;
+	rc = uidMovecopy(h, pw->baseDirName, &uid, 1, (cmd == 'm'), path);
+	if(rc && cmd == 'm' && !a->move_capable)
+		rc = uidDelete(h, pw->baseDirName, &uid, 1);
 	if(!rc) return false;
 
-	if(cmd == 'm' && !a->move_capable) {
-		sprintf(cust_cmd, "uid STORE %d +Flags \\Deleted", uid);
-		curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, cust_cmd);
-		res = getMailData(h);
-		nzFree(mailstring), mailstring = 0;
-		if (res != CURLE_OK) {
-			ebcurl_setError(res, cf->firstURL, 0, cerror);
-			return false;
-		}
-		expunge(h);
-	}
-
 	if(cmd == 't') return true; // copy, nothing else to do
 
 	undoSpecialClear();
@@ -4781,14 +5996,12 @@ baddest:
 
 bool imapDeleteWhileReading(void)
 {
-	CURLcode res;
 	const Window *pw = cw->prev;
 	int uid = cw->imap_n;
 	CURL *h = pw->imap_h;
 	int act = pw->imap_n;
 	struct MACCOUNT *a = accounts + act - 1;
 	bool rc;
-	char cust_cmd[80];
 
 // does delete really mean move?
 	if(a->dxtrash && !a->dxfolder[pw->r_dot]) {
@@ -4801,10 +6014,8 @@ bool imapDeleteWhileReading(void)
 		return imapMovecopyWhileReading('m', destn);
 	}
 
-	sprintf(cust_cmd, "uid STORE %d +Flags \\Deleted", uid);
-	rc = tryTwice(h, pw->baseDirName, cust_cmd);
+	rc = uidDelete(h, pw->baseDirName, &uid, 1);
 	if(!rc) return false;
-	 expunge(h);
 
 	undoSpecialClear();
 	saveSubstitutionStrings();
@@ -4863,7 +6074,7 @@ badsave:
 	} else {
 // key = w, write the file and save the original unformatted
 		saveRawMail(cw->mail_raw, cw->imap_l);
-		if((fsize = saveFormattedMail(fh)) < 0) goto badsave;
+		if((fsize = saveFormattedMail(fh, name)) < 0) goto badsave;
 	}
 	close(fh);
 	debugPrint(1, "%ld", fsize);
@@ -4984,6 +6195,7 @@ bool deleteFolder(int ln)
 	curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, v);
 	free(v);
 	res = getMailData(h);
+	selForget(h);
 	nzFree(mailstring), mailstring = 0;
 	if (res != CURLE_OK) {
 		i_printf(MSG_NoDelete3, p);
@@ -5006,6 +6218,7 @@ bool renameFolder(const char *src, const char *dest)
 	curl_easy_setopt(h, CURLOPT_CUSTOMREQUEST, v);
 	free(v);
 	res = getMailData(h);
+	selForget(h);
 	nzFree(mailstring), mailstring = 0;
 	if (res != CURLE_OK) {
 		i_printf(MSG_NoRename3, src);
@@ -5029,9 +6242,414 @@ static void *imapCleanupThread(void *ptr)
 
 void imapCleanupInBackground(CURL *h)
 {
+	selForget(h);
 // If this causes any trouble than just easy_cleanup and return
 	pthread_t tid;
 	CURL **box = allocMem(sizeof(CURL*));
 	*box = h;
 	pthread_create(&tid, NULL, imapCleanupThread, (void *)box);
 }
+
+/*********************************************************************
+Push notification, imap IDLE, on an envelope buffer.
+The idle command opens a second connection to the server,
+examines the folder, and sits in IDLE, so the server tells us
+when mail arrives, or is expunged, or is flagged by another client.
+libcurl sends a command and waits for its tagged response;
+it can't leave IDLE hanging and send DONE when we please.
+So this connection is curl's in name only: with CONNECT_ONLY,
+curl connects, does the tls, and logs in,
+then we talk to the server ourselves through curl_easy_send and recv.
+The input loop polls these connections every few seconds.
+When something changes, we refresh the envelopes over the main connection,
+which the envelope cache makes cheap, and merge them into the buffer
+line by line, so dot, and the lines you are looking at, stay put.
+Servers drop an idle connection after 30 minutes, so renew IDLE every 25.
+*********************************************************************/
+
+#define IDLEPOLL 5
+#define IDLERENEW (25 * 60)
+#define IDLEWAIT 30		// for a tagged response
+
+struct IDLER {
+	struct IDLER *next, *prev;
+	Window *w;		// the envelope buffer
+	CURL *h;
+	curl_socket_t sock;
+	char *buf;		// what the server has sent, up to a partial line
+	int len;
+	int tag;
+	bool idling, changed;
+	time_t since;
+};
+static struct listHead idlers = { &idlers, &idlers };
+
+int imapIdleDelay(void)
+{
+	return (idlers.next == (void *)&idlers ? 0 : IDLEPOLL);
+}
+
+static bool idleWaitSock(const struct IDLER *d, bool out)
+{
+	fd_set fds;
+	struct timeval tv;
+	FD_ZERO(&fds);
+	FD_SET(d->sock, &fds);
+	tv.tv_sec = 1, tv.tv_usec = 0;
+	return select(d->sock + 1, (out ? 0 : &fds), (out ? &fds : 0), 0, &tv) > 0;
+}
+
+static bool idleSend(struct IDLER *d, const char *s)
+{
+	size_t l = strlen(s), n;
+	CURLcode res;
+	debugPrint(4, "idle > %s", s);
+	while (l) {
+		res = curl_easy_send(d->h, s, l, &n);
+		if (res == CURLE_AGAIN) {
+			idleWaitSock(d, true);
+			continue;
+		}
+		if (res != CURLE_OK)
+			return false;
+		s += n, l -= n;
+	}
+	return true;
+}
+
+// gather what the server has sent, without blocking.
+// Returns false if the connection is gone.
+static bool idleRecv(struct IDLER *d)
+{
+	char chunk[1024];
+	size_t n;
+	CURLcode res;
+	if (!d->buf)
+		d->buf = initString(&d->len);
+	while (true) {
+		res = curl_easy_recv(d->h, chunk, sizeof(chunk), &n);
+		if (res == CURLE_AGAIN)
+			return true;
+		if (res != CURLE_OK || !n)
+			return false;
+		stringAndBytes(&d->buf, &d->len, chunk, n);
+	}
+}
+
+// pull the next complete line out of the buffer, crlf removed
+static char *idleLine(struct IDLER *d)
+{
+	char *t, *line;
+	int l;
+	if (!d->buf || !(t = strchr(d->buf, '\n')))
+		return 0;
+	l = t - d->buf;
+	line = allocMem(l + 1);
+	memcpy(line, d->buf, l);
+	if (l && line[l - 1] == '\r')
+		--l;
+	line[l] = 0;
+	++t;
+	d->len -= t - d->buf;
+	memmove(d->buf, t, d->len + 1);
+	debugPrint(4, "idle < %s", line);
+	return line;
+}
+
+// does this untagged response change the folder?
+static void idleNote(struct IDLER *d, const char *line)
+{
+	if (!d->idling || line[0] != '*')
+		return;
+	if (strstr(line, " EXISTS") || strstr(line, " EXPUNGE") ||
+	    strstr(line, " FETCH "))
+		d->changed = true;
+}
+
+// wait for the tagged response to command tag, or for + if tag is 0
+static bool idleWaitTag(struct IDLER *d, int tag)
+{
+	char prefix[16], *line;
+	int l;
+	bool ok;
+	time_t start = time(0);
+	int limit = (mailTimeout > 0 ? mailTimeout : IDLEWAIT);
+
+	sprintf(prefix, "e%d ", tag);
+	l = strlen(prefix);
+	while (true) {
+		if (!idleRecv(d))
+			return false;
+		while ((line = idleLine(d))) {
+			if (tag ? !strncmp(line, prefix, l) : line[0] == '+') {
+				ok = (!tag || !strncmp(line + l, "OK", 2));
+				nzFree(line);
+				return ok;
+			}
+			idleNote(d, line);
+			nzFree(line);
+		}
+		if (time(0) - start > limit)
+			return false;
+		idleWaitSock(d, false);
+	}
+}
+
+static bool idleBegin(struct IDLER *d)
+{
+	char cmd[24];
+	sprintf(cmd, "e%d IDLE\r\n", ++d->tag);
+	if (!idleSend(d, cmd) || !idleWaitTag(d, 0))
+		return false;
+	d->idling = true;
+	time(&d->since);
+	return true;
+}
+
+static bool idleEnd(struct IDLER *d)
+{
+	bool ok = idleSend(d, "DONE\r\n") && idleWaitTag(d, d->tag);
+	d->idling = false;
+	return ok;
+}
+
+static void idleDrop(struct IDLER *d)
+{
+	delFromList(d);
+// logout can hang on a dead server, let that happen in the background
+	imapCleanupInBackground(d->h);
+	nzFree(d->buf);
+	free(d);
+}
+
+void imapIdleStop(const Window *w)
+{
+	struct IDLER *d;
+	foreach(d, idlers) {
+		if (d->w != w)
+			continue;
+		if (d->idling)
+			idleSend(d, "DONE\r\n");
+		idleDrop(d);
+		return;
+	}
+}
+
+// the idle command toggles push notification on an envelope buffer
+bool imapIdle(void)
+{
+	struct IDLER *d;
+	struct MACCOUNT *a = accounts + cw->imap_n - 1;
+	const Window *pw;
+	const char *url;
+	char host[MAXHOSTLEN];
+	char *cmd;
+	CURLcode res;
+	bool ok;
+
+	foreach(d, idlers) {
+		if (d->w == cw) {
+			imapIdleStop(cw);
+			if (helpMessagesOn || debugLevel >= 1)
+				i_puts(MSG_IdleOff);
+			return true;
+		}
+	}
+
+// the mailbox url is on the folders buffer
+	for (pw = cw; pw && !pw->imapMode1; pw = pw->prev) ;
+	if (!pw || !pw->f0.firstURL) {
+		setError(MSG_NotImap);
+		return false;
+	}
+	url = pw->f0.firstURL;
+
+	active_a = a, isimap = true;
+	d = allocZeroMem(sizeof(struct IDLER));
+	d->w = cw;
+	d->h = newFetchmailHandle(a->login, a->password);
+	curl_easy_setopt(d->h, CURLOPT_VERBOSE, (long)(debugLevel >= 4));
+	curl_easy_setopt(d->h, CURLOPT_CONNECT_ONLY, 1L);
+	res = setCurlURL(d->h, url);
+	if (res == CURLE_OK)
+		res = curl_easy_perform(d->h);
+	if (res != CURLE_OK) {
+		ebcurl_setError(res, url, 0, cerror);
+		curl_easy_cleanup(d->h);
+		free(d);
+		return false;
+	}
+	curl_easy_getinfo(d->h, CURLINFO_ACTIVESOCKET, &d->sock);
+
+	ignore = asprintf(&cmd, "e%d EXAMINE \"%s\"\r\n", ++d->tag, cw->baseDirName);
+	ok = (idleSend(d, cmd) && idleWaitTag(d, d->tag) && idleBegin(d));
+	free(cmd);
+	addToListBack(&idlers, d);
+	if (!ok) {
+		idleDrop(d);
+		if (!getProtHostURL(url, 0, host))
+			host[0] = 0;
+		setError(MSG_WebProtBad, "idle", host);
+		return false;
+	}
+	if (helpMessagesOn || debugLevel >= 1)
+		i_printf(MSG_IdleOn, withoutSubstringPath(cw->baseDirName));
+	return true;
+}
+
+// put an envelope line into the buffer after line ln, with its uid
+static void idleInsert(int ln, const char *line, const char *path)
+{
+	struct lineMap *newmap;
+	int dot = cw->dot, olddol = cw->dol;
+	char *s;
+
+	ignore = asprintf(&s, "%s\n", line);
+	addTextToBuffer((uchar *) s, strlen(s), ln, false);
+	free(s);
+	newmap = allocZeroMem((cw->dol + 2) * LMSIZE);
+	if (cw->r_map) {
+		memcpy(newmap, cw->r_map, (ln + 1) * LMSIZE);
+		memcpy(newmap + ln + 2, cw->r_map + ln + 1,
+		       (olddol - ln + 1) * LMSIZE);
+		free(cw->r_map);
+	}
+	newmap[ln + 1].text = (uchar *) cloneString(path);
+	cw->r_map = newmap;
+	cw->dot = (dot > ln ? dot + 1 : dot);
+}
+
+static void idleDelete(int ln)
+{
+	int dot = cw->dot;
+	delText(ln, ln);
+	if (dot > ln)
+		--dot;
+	if (dot > cw->dol)
+		dot = cw->dol;
+	cw->dot = dot;
+}
+
+/*********************************************************************
+Merge a fresh list of envelopes into the buffer.
+Both are in uid order, so walk them together;
+a uid only in the buffer has gone, a uid only in the list is new,
+and a uid in both may have a new line, if it was read, for instance.
+*********************************************************************/
+
+static void idleMerge(const struct FOLDER *f)
+{
+	const struct MIF *mif = f->mlist;
+	int ln = 1, j = 0, ou, nu;
+	int nadd = 0, ndel = 0;
+	char *p, *path;
+
+	while (ln <= cw->dol || j < f->nfetch) {
+		ou = (ln <= cw->dol ? atoi((char *)cw->r_map[ln].text) : 0x7fffffff);
+		nu = (j < f->nfetch ? mif[j].uid : 0x7fffffff);
+		if (ou < nu) {
+			idleDelete(ln);
+			++ndel;
+			continue;
+		}
+		printEnvelope(mif + j, &p);
+		if (nu < ou) {
+			ignore = asprintf(&path, "%d|%s", nu, mif[j].subject);
+			idleInsert(ln - 1, p, path);
+			free(path);
+			++nadd;
+		} else {
+			int l = strlen(p);
+			const char *s = (char *)cw->map[ln].text;
+			if ((int)pstLength((uchar *) s) != l + 1 || memcmp(s, p, l)) {
+				char *t = allocMem(l + 2);
+				memcpy(t, p, l);
+				t[l] = '\n', t[l + 1] = 0;
+				cnzFree(s);
+				cw->map[ln].text = (uchar *) t;
+			}
+		}
+		nzFree(p);
+		++ln, ++j;
+	}
+
+	if (nadd | ndel)
+		debugPrint(1, "%s: %d new, %d gone",
+			   withoutSubstringPath(cw->baseDirName), nadd, ndel);
+}
+
+// something changed in this folder, fetch the envelopes again and merge
+static void idleRefresh(struct IDLER *d)
+{
+	Window *w = d->w, *save_cw = cw;
+	Frame *save_cf = cf;
+	CURL *h = w->imap_h;
+	CURLcode res = CURLE_OK;
+	struct FOLDER f0;
+	bool ok;
+
+	cw = w, cf = &w->f0;
+	active_a = accounts + w->imap_n - 1, isimap = true;
+	memset(&f0, 0, sizeof(f0));
+	f0.path = w->baseDirName;
+	if (w->mail_raw) {
+// a search buffer, run the search again
+		char *search = cloneString(w->mail_raw);
+		bool unseen = (*search == 'u');
+		res = selectFolder(h, f0.path, false, false);
+		nzFree(mailstring), mailstring = 0;
+		ok = (res == CURLE_OK &&
+		      imapSearch(h, &f0, search + unseen, unseen, &res) >= 0);
+		nzFree(search);
+	} else {
+		ok = examineFolder(h, &f0, false);
+	}
+	if (ok)
+		idleMerge(&f0);
+	cleanFolder(&f0);
+	cw = save_cw, cf = save_cf;
+}
+
+// called from the input loop, every few seconds, while we are idling
+void imapIdlePoll(void)
+{
+	struct IDLER *d, *next;
+	char *line;
+	bool alive;
+	time_t now;
+
+	time(&now);
+	for (d = idlers.next; d != (void *)&idlers; d = next) {
+		next = d->next;
+		active_a = accounts + d->w->imap_n - 1;
+		alive = idleRecv(d);
+		while ((line = idleLine(d))) {
+			if (!strncmp(line, "* BYE", 5))
+				alive = false;
+			idleNote(d, line);
+			nzFree(line);
+		}
+		if (!alive || !d->w->imap_h) {
+			if (debugLevel >= 1)
+				i_printf(MSG_IdleLost,
+					 withoutSubstringPath(d->w->baseDirName));
+			idleDrop(d);
+			continue;
+		}
+		if (!d->changed && now - d->since < IDLERENEW)
+			continue;
+		if (!idleEnd(d))
+			goto lost;
+		if (d->changed) {
+			d->changed = false;
+			idleRefresh(d);
+		}
+		if (idleBegin(d))
+			continue;
+lost:
+		if (debugLevel >= 1)
+			i_printf(MSG_IdleLost,
+				 withoutSubstringPath(d->w->baseDirName));
+		idleDrop(d);
+	}
+}
@@ -64,70 +64,20 @@ void prepareForField(char *h)
 }
 
 /*********************************************************************
-The characters 03 and 04 delimite the cells of a table, or data, respectively.
-We often don't know, so fall back to table.
-And tables are often used to format a page, not a real table.  Ugh!
-This routine turns either of these into |
-However if there is one such | on a line, and it is a table cell marker,
-we remove it. Most of the time the table is page layout,
-and the | would only confuse things.
-Remove whitespace before or after <td>, as tidy does.
+The first walk over the rendered text does three jobs,
+marking the cells of a table, transliterating characters like /bin/tr,
+and cleaning up whitespace after headings.
+Each job follows a little behind the one before it,
+so the text is read once, while it is still in cache.
+Each job writes behind where it reads, so this is all done in place.
 *********************************************************************/
 
-static void cellDelimiters(char *buf)
-{
-	char *lastcell = 0;
-	int cellcount = 0;
-	char *s, *t;
-
-	for (s = t = buf; *s; ++s) {
-		int n;
-		char *u;
-		if(*s != DataCellChar && *s != TableCellChar) {
-			*t++ = *s;
-			continue;
-		}
-// spaces behind
-		while(t > buf && t[-1] == ' ') --t;
-		*t++ = *s; // cell marker
-// spaces ahead
-respace:
-		if(s[1] == ' ') { ++s; goto respace; }
-// tidy turns <td> <i> hello </i> </td> into <td><i>hello</i></td>
-// But not so with <p> or other strong tags.
-// I try to do the same.
-		if(s[1] != InternalCodeChar || !isdigitByte(s[2])) continue;
-			n = strtol(s + 2, &u, 10);
-// leave input fields alone
-			if(*u != '*' && *u != '{') continue;
-			if(tagList[n]->info->para & 3) continue;
-// looks like a soft tag
-			memcpy(t, s + 1, u - s);
-			t += u - s;
-			s = u;
-			goto respace;
-	}
-	*t = 0;
-
-	for (s = buf; *s; ++s) {
-		if (*s == DataCellChar) {
-			*s = '|';
-			continue;
-		}
-		if (*s == TableCellChar) {
-			*s = '|';
-			lastcell = s;
-			++cellcount;
-			continue;
-		}
-		if (!strchr("\f\r\n", *s))
-			continue;
-// newline here, if just one cell delimiter then blank it out
-		if (cellcount == 1)
-			*lastcell = ' ';
-		cellcount = 0;
-	}
-}
+static char *tr_s, *tr_w;	// where html_tr reads and writes
+static bool tr_input;		// inside an input field
+static const char *tr_pua;
+static char *hd_s, *hd_w;	// where html_heading reads and writes
+static bool hd_in1, hd_in2;
+static int hd_skip1, hd_copy2;
 
 /*********************************************************************
 this is transliteration, like /bin/tr
@@ -144,26 +94,26 @@ If they are used by your private work website, and you need to retain them,
 export EB_PUA=on
 Don't do any of these transliterations in an input field.
 Those must be exactly preserved, obviously.
+This translates the cell marked text up to end,
+which is always just past a newline, or the end of the buffer.
 *********************************************************************/
 
-static void html_tr(char *buf)
+static void html_tr(const char *end)
 {
 	char *s, *ss, *w, c, d;
 	int n;
 	static const char from[] = "\x1b\x95\x99\x9c\x9d\x91\x92\x93\x94\xa0\xad\x96\x97\x85";
 	static const char becomes[] = "_*'`'`'`' x---";
-	bool inputmode = false;
-	char *pua = getenv("EB_PUA");
-	if(pua && !*pua) pua = 0;
 
-	for (s = w = buf; (c = *s); ++s) {
+	for (s = tr_s, w = tr_w; s < end; ++s) {
+		c = *s;
 		d = s[1];
 		if (c == InternalCodeChar && isdigitByte(d)) {
 			int tagno = strtol(s + 1, &ss, 10);
 			if (*ss == '<' && !stringEqual(tagList[tagno]->info->name, "button"))
-				inputmode = true;
+				tr_input = true;
 			if (*ss == '>')
-				inputmode = false;
+				tr_input = false;
 			++ss;
 			n = ss - s;
 			memmove(w, s, n);
@@ -172,7 +122,7 @@ static void html_tr(char *buf)
 			continue;
 		}
 
-		if (inputmode)
+		if (tr_input)
 			goto put1;
 
 // utf8 test
@@ -209,7 +159,7 @@ static void html_tr(char *buf)
 			if(((uni >= 0xe000 && uni < 0xf8ff) ||
 			(uni >= 0xf0000 && uni < 0xffffd) ||
 			(uni >= 0x100000 && uni < 0x10fffd)) &&
-			!pua)
+			!tr_pua)
 				w -= ubytes+1;
 			continue;
 		}
@@ -225,39 +175,125 @@ static void html_tr(char *buf)
 put1:
 		*w++ = c;
 	}
-	*w = 0;
+	tr_s = s, tr_w = w;
 }
 
-// For <h3><div>hello</div></h3> which should not happen, but does
-// And for <blockquote><p> which is prefectly fine
-static void h3div(char *buf)
+/*********************************************************************
+For <h3><div>hello</div></h3> which should not happen, but does,
+whitespace after the heading becomes spaces.
+And for <blockquote><p> which is prefectly fine,
+whitespace after the quote goes away.
+This was two passes, the quote pass reading what the heading pass wrote.
+The heading pass only turns whitespace into spaces,
+so the quote pass can look ahead at the same characters,
+and take the current one from the heading pass.
+Both look 3 characters ahead, in translated text, thus they run up to end-3,
+or to end when end is the end of the buffer.
+*********************************************************************/
+
+static void html_heading(const char *end, bool last)
 {
-	char *s, *t;
-	bool in_h = false;
-	for(s = buf; *s; ++s) {
-		if(*s == '\f' && s[1] == 'h' &&
-		(uchar)s[2] >= '1' && (uchar)s[2] <= '6' && s[3] == ' ') {
-			in_h = true, s += 3;
+	char *s, *t, c;
+
+	for(s = hd_s, t = hd_w; s < end && (last || s + 3 < end); ++s) {
+		c = *s;
+		if(hd_skip1) --hd_skip1;
+		else if(c == '\f' && s[1] == 'h' &&
+		(uchar)s[2] >= '1' && (uchar)s[2] <= '6' && s[3] == ' ')
+			hd_in1 = true, hd_skip1 = 3;
+		else if(!isspaceByte(c)) hd_in1 = false;
+		else if(hd_in1) c = ' ';
+// copy \f`` and drop the whitespace after it
+		if(hd_copy2) {
+			--hd_copy2;
+			*t++ = c;
 			continue;
 		}
-		if(isspaceByte(*s)) {
-			if(in_h) *s = ' ';
-		} else in_h = false;
-	}
-	in_h = false;
-	for(s = t = buf; *s; ++s) {
-		if(*s == '\f' && s[1] == '`' && s[2] == '`'
+		if(c == '\f' && s[1] == '`' && s[2] == '`'
 		&& isspaceByte(s[3])) {
-			memcpy(t, s, 3);
-			in_h = true, s += 3, t += 3;
+			*t++ = c;
+			hd_in2 = true, hd_copy2 = 2;
 			continue;
 		}
-		if(isspaceByte(*s)) {
-			if(in_h) continue;
-		} else in_h = false;
-		*t++ = *s;
+		if(isspaceByte(c)) {
+			if(hd_in2) continue;
+		} else hd_in2 = false;
+		*t++ = c;
+	}
+	hd_s = s, hd_w = t;
+}
+
+/*********************************************************************
+The characters 03 and 04 delimite the cells of a table, or data, respectively.
+We often don't know, so fall back to table.
+And tables are often used to format a page, not a real table.  Ugh!
+This routine turns either of these into |
+However if there is one such | on a line, and it is a table cell marker,
+we remove it. Most of the time the table is page layout,
+and the | would only confuse things.
+Remove whitespace before or after <td>, as tidy does.
+Both of these reach back into the line we are on,
+so the line is not finished until we pass its newline.
+Then it is handed to html_tr, and what html_tr has finished
+is handed to html_heading.
+*********************************************************************/
+
+static void html_cells(char *buf)
+{
+	char *lastcell = 0;
+	int cellcount = 0;
+	char *s, *t;
+
+	tr_s = tr_w = hd_s = hd_w = buf;
+	tr_input = hd_in1 = hd_in2 = false;
+	hd_skip1 = hd_copy2 = 0;
+	tr_pua = getenv("EB_PUA");
+	if(tr_pua && !*tr_pua) tr_pua = 0;
+
+	for (s = t = buf; *s; ++s) {
+		int n;
+		char *u;
+		if(*s != DataCellChar && *s != TableCellChar) {
+// newline here, if just one cell delimiter then blank it out
+			if (strchr("\f\r\n", *s)) {
+				if (cellcount == 1)
+					*lastcell = ' ';
+				cellcount = 0;
+				*t++ = *s;
+				html_tr(t);
+				html_heading(tr_w, false);
+				continue;
+			}
+			*t++ = *s;
+			continue;
+		}
+// spaces behind
+		while(t > buf && t[-1] == ' ') --t;
+		if (*s == TableCellChar)
+			lastcell = t, ++cellcount;
+		*t++ = '|'; // cell marker
+// spaces ahead
+respace:
+		if(s[1] == ' ') { ++s; goto respace; }
+// tidy turns <td> <i> hello </i> </td> into <td><i>hello</i></td>
+// But not so with <p> or other strong tags.
+// I try to do the same.
+		if(s[1] != InternalCodeChar || !isdigitByte(s[2])) continue;
+			n = strtol(s + 2, &u, 10);
+// leave input fields alone
+			if(*u != '*' && *u != '{') continue;
+			if(tagList[n]->info->para & 3) continue;
+// looks like a soft tag
+			memcpy(t, s + 1, u - s);
+			t += u - s;
+			s = u;
+			goto respace;
 	}
 	*t = 0;
+	html_tr(t);
+	*tr_w = 0;
+	html_heading(tr_w, true);
+	*hd_w = 0;
 }
 
 /*********************************************************************
@@ -272,7 +308,11 @@ All this swapping preserves the length of the string.
 If a change is made, the procedure is run again,
 kinda like bubble sort.
 It has the potential to be terribly inefficient,
-but that doesn't seem to happen in practice.
+a row of 50 empty cells takes 50 passes, each over the entire page.
+So each pass starts where the last one made its first change,
+or rather, at the last point before that change where nothing was pending,
+no whitespace and no anchor. The text before that point hasn't changed,
+so a pass from the top would find nothing to do there.
 Use cnt to count the iterations, for debugging purposes.
 | is considered a whitespace character. Why is that?
 Html tables are mostly used for visual layout, but sometimes not.
@@ -294,19 +334,23 @@ static void anchorSwap(char *buf)
 	bool strong;		// strong whitespace, newline or paragraph
 	int n = 0, cnt, tagno = 0;
 	char tag[20];
+	char *restart = buf, *clean = buf;
+	bool restartpre = false, cleanpre = false;
 
 	cnt = 0;
 	change = true;
 	while (change) {
 		change = false;
 		++cnt;
-		premode = false;
+		premode = restartpre;
 // w represents the state of whitespace
 		w = NULL;
 // a points to the prior anchor, which is swappable with following whitespace
 		a = NULL;
 
-		for (s = buf; (c = *s); ++s) {
+		for (s = restart; (c = *s); ++s) {
+			if (!w && !a)
+				clean = s, cleanpre = premode;
 			if (isspaceByte(c) || (c == '|' && !premode)) {
 #if 0
 				if (c == '\t' && !premode)
@@ -324,6 +368,8 @@ static void anchorSwap(char *buf)
 // don't move td past newline; it screws things up.
 				if(t->action != TAGACT_TD) {
 tagforward:
+					if (!change)
+						restart = clean, restartpre = cleanpre;
 					memmove(a, w, s - w);
 					memmove(a + (s - w), tag, n);
 					change = true;
@@ -364,6 +410,8 @@ afterforward:
 
 /* We have a tag, should we swap it with prior whitespace? */
 			if (w && !premode && d == '}') {
+				if (!change)
+					restart = clean, restartpre = cleanpre;
 				memmove(w + n, w, s - w);
 				memcpy(w, tag, n);
 				change = true;
@@ -385,14 +433,128 @@ normalChar:
 	debugPrint(4, "anchorSwap %d", cnt);
 }
 
+/*********************************************************************
+The walk after anchorSwap also does three jobs.
+It removes framing characters around anchors,
+compresses the implied linebreaks, and pulls multiline hyperlinks
+back down to one line.
+As before, each job follows a little behind the one before it.
+*********************************************************************/
+
+static char *ws_s;		// where html_ws has got to
+static bool ws_pre;		// inside <pre> </pre>
+static bool ws_link;		// inside a hyperlink or button
+
+/*********************************************************************
+Now compress the implied linebreaks into one.
+This works on the unframed text up to end, which is just past a newline,
+and stops where it would have to look beyond end, unless this is the last call.
+Some hyperlinks are multiline, due to some html inside, and our interpretation
+of said html. This is just annoying, so pull it back down to one line.
+Same goes for <button>, but other input fields must remain as they are.
+Even submit, as shown by jsrt, if you submit the form it says b1=Send%20Message
+hence it would send a newline if there was one.
+*********************************************************************/
+
+static void html_ws(const char *end, bool last)
+{
+	char c, *s, *w, *w2, *a, *u;
+	int n;
+	bool pretag, strong, slash;
+	char *ss = 0;
+
+	for (s = ws_s; s < end; ++s) {
+		c = *s;
+
+// look for <pre>, and for hyperlinks
+		if (c == InternalCodeChar && isdigitByte(s[1])) {
+			n = strtol(s + 1, &u, 10);
+			if(u >= end) {
+				if(!last) break;
+				s = u;
+				continue;
+			}
+			if(ws_link) {
+				if(s[1] == '0')
+					ws_link = false;
+			} else if(*u == '{' ||
+			(*u == '<' && stringEqual(tagList[n]->info->name, "button")))
+				ws_link = true;
+			s = u;
+			if (*s == '*') {
+				preFormatCheck(n, &pretag, &slash);
+				if (pretag) ws_pre = !slash;
+			}
+		}
+
+		if (!isspaceByte(c)) continue;
+
+// whitespace region starts here.
+// strong is anything harder than space, like <br> or <p> or <div>
+		strong = false;
+// watch for pipes inside whitespace, these are usually cell delimiters.
+// pipe ends a whitespace region if only spaces come before
+		for (w = s; w < end && (isspaceByte(*w) || (*w == '|' && !ws_pre)); ++w) {
+			if(*w == '|') {
+				if(strong) continue;
+				break;
+			}
+			if(*w != ' ') strong = true;
+		}
+		if(w >= end && !last) break;
+
+// whitespace region from s up to w
+// pipes have to be internal to whitespace to be moved;
+// pipes at the end are left alone.
+// Look ahead past anchors
+		w2 = w;
+		while(w2 < end && *w2 == InternalCodeChar) {
+			n = strtol(w2 + 1, &w2, 10);
+			++w2;
+		}
+		if(w2 >= end && !last) break;
+		if(w2 < end)
+			while(w[-1] == '|') --w;
+
+// move internal pipes to the front
+		for(ss = --w; w >= s; --w)
+			if(*w != '|') *ss-- = *w;
+		while(ss >= s) *ss-- = '|';
+		while(*s == '|') ++s;
+
+		strong = false, a = 0;
+		for (w = s; isspaceByte(*w); ++w) {
+			if (*w == '\n' || *w == '\f')
+				strong = true;
+			if (*w == '\r' && !a)
+				a = w;
+		}
+		ss = s, s = w - 1;
+		if (a && !ws_pre) {
+			for (w = ss; w <= s; ++w)
+				if (*w == '\r' && (strong || w != a))
+					*w = ' ';
+		}
+		if (ws_link) {
+			for (w = ss; w <= s; ++w)
+				if (*w == '\n' || *w == '\f')
+					*w = ' ';
+		}
+	}			// loop over buffer
+	ws_s = s;
+}
+
 /* Framing characters like [] around an anchor are unnecessary here,
  * because we already frame it in braces.
- * Get rid of these characters, even in premode. */
+ * Get rid of these characters, even in premode.
+ * The unframed text is handed to html_ws a line at a time. */
 static void anchorUnframe(char *buf)
 {
 	char c, d, *s, *w, *a;
 	int n;
 
+	ws_s = buf;
+	ws_pre = ws_link = false;
 	for (s = w = buf; (c = *s); ++s) {
 		char open, close, linkchar;
 		if (!strchr("{[(<", c))
@@ -448,90 +610,16 @@ static void anchorUnframe(char *buf)
 		continue;
 putc:
 		*w++ = c;
+		if (c == '\n' || c == '\f')
+			html_ws(w, false);
 	}			// loop over buffer
 	*w = 0;
-	debugPrint(4, "anchors unframed");
-}
-
-// Now compress the implied linebreaks into one.
-static void html_ws(char *buf)
-{
-	char c, d, *s, *w, *w2, *a;
-	int n;
-	bool premode = false, pretag, strong, slash;
-	char *ss = 0;
-
-	for (s = buf; (c = *s); ++s) {
-
-// look for <pre>
-		if (c == InternalCodeChar && isdigitByte(s[1])) {
-			n = strtol(s + 1, &s, 10);
-			if (*s == '*') {
-				preFormatCheck(n, &pretag, &slash);
-				if (pretag) premode = !slash;
-			}
-		}
-
-		if (!isspaceByte(c)) continue;
-
-// whitespace region starts here.
-// strong is anything harder than space, like <br> or <p> or <div>
-		strong = false;
-// watch for pipes inside whitespace, these are usually cell delimiters.
-// pipe ends a whitespace region if only spaces come before
-		for (w = s; isspaceByte(*w) || (*w == '|' && !premode); ++w) {
-			if(*w == '|') {
-				if(strong) continue;
-				break;
-			}
-			if(*w != ' ') strong = true;
-		}
-
-// whitespace region from s up to w
-// pipes have to be internal to whitespace to be moved;
-// pipes at the end are left alone.
-// Look ahead past anchors
-		w2 = w;
-		while(*w2 == InternalCodeChar) {
-			n = strtol(w2 + 1, &w2, 10);
-			++w2;
-		}
-		if(*w2)
-			while(w[-1] == '|') --w;
-
-// move internal pipes to the front
-		for(ss = --w; w >= s; --w)
-			if(*w != '|') *ss-- = *w;
-		while(ss >= s) *ss-- = '|';
-		while(*s == '|') ++s;
-
-		strong = false, a = 0;
-		for (w = s; isspaceByte(*w); ++w) {
-			if (*w == '\n' || *w == '\f')
-				strong = true;
-			if (*w == '\r' && !a)
-				a = w;
-		}
-		ss = s, s = w - 1;
-		if (!a)
-			continue;
-		if (premode)
-			continue;
-		if (strong) {
-			for (w = ss; w <= s; ++w)
-				if (*w == '\r')
-					*w = ' ';
-			continue;
-		}
-		for (w = ss; w <= s; ++w)
-			if (*w == '\r' && w != a)
-				*w = ' ';
-	}			// loop over buffer
-	debugPrint(4, "whitespace combined");
+	html_ws(w, true);
+	debugPrint(4, "anchors unframed, whitespace combined");
 
 /* Due to the anchor swap, the buffer could end in whitespace
  * followed by several anchors. Trim these off. */
-	s = buf + strlen(buf);
+	s = w;
 	while (s > buf + 1 && s[-1] == '*' && isdigitByte(s[-2])) {
 		for (w = s - 3; w >= buf && isdigitByte(*w); --w) ;
 		if (w < buf || *w != InternalCodeChar)
@@ -539,32 +627,6 @@ static void html_ws(char *buf)
 		s = w;
 	}
 	*s = 0;
-
-/*********************************************************************
-Some hyperlinks are multiline, due to some html inside, and our interpretation
-of said html. This is just annoying, so pull it back down to one line.
-Same goes for <button>, but other input fields must remain as they are.
-Even submit, as shown by jsrt, if you submit the form it says b1=Send%20Message
-hence it would send a newline if there was one.
-*********************************************************************/
-
-	for (s = buf; (c = *s); ++s) {
-		if (c != InternalCodeChar)
-			continue;
-		n = strtol(s + 1, &s, 10);
-		if (*s == '<') {
-			if (!stringEqual(tagList[n]->info->name, "button"))
-				continue;
-		} else if (*s != '{')
-			continue;
-		for (a = s + 1; (c = *a); ++a) {
-			if (c == InternalCodeChar && a[1] == '0')
-				break;
-			if (c == '\n' || c == '\f')
-				*a = ' ';
-		}
-		s = a;
-	}
 }
 
 /*********************************************************************
@@ -1095,6 +1157,16 @@ bool balanceLine(const char *line, int mark)
 	return false;
 }
 
+// The text after each group of passes in htmlReformat, and the formatted page
+// at the end, are handed to this function if it is set. reformcheck uses it.
+void (*reformatHook)(int pass, const char *buf);
+
+static void reformatPass(int pass, const char *name, const char *buf)
+{
+	if(debugLayout) printf("%s<%s>\n", name, buf);
+	if(reformatHook) (*reformatHook)(pass, buf);
+}
+
 char *htmlReformat(char *buf)
 {
 	const char *h, *nh, *s;
@@ -1106,18 +1178,12 @@ char *htmlReformat(char *buf)
 	char *fmark;		/* mark the start of a frame */
 
 	if(debugLayout) printf("rendered<%s>\n", buf);
-	cellDelimiters(buf);
-	if(debugLayout) printf("cells<%s>\n", buf);
-	html_tr(buf);
-	if(debugLayout) printf("translate<%s>\n", buf);
-	h3div(buf);
-	if(debugLayout) printf("h3div<%s>\n", buf);
+	html_cells(buf);
+	reformatPass(1, "cells", buf);
 	anchorSwap(buf);
-	if(debugLayout) printf("swap<%s>\n", buf);
+	reformatPass(2, "swap", buf);
 	anchorUnframe(buf);
-	if(debugLayout) printf("unframe<%s>\n", buf);
-	html_ws(buf);
-	if(debugLayout) printf("whitespace<%s>\n", buf);
+	reformatPass(3, "whitespace", buf);
 
 	longcut = lperiod = lcomma = lright = lany = 0;
 	colno = 1;
@@ -1215,6 +1281,7 @@ char *htmlReformat(char *buf)
 			strmove(fmark + 5, fmark + 6);
 	}
 
+	if(reformatHook) (*reformatHook)(4, new);
 	return new;
 }
 
@@ -2146,6 +2213,32 @@ char *force_utf8(char *buf, int buflen)
 static const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+/*********************************************************************
+Value of each byte as a base64 digit, so decoding is a lookup, not a
+run of character class tests.
+64 is not a digit, 65 is white space, 66 is the = pad.
+All three have the 64 bit set, so one test tells whether a byte is a digit.
+*********************************************************************/
+
+static const uchar base64_vals[256] = {
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 65, 65, 65, 65, 65, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	65, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 62, 64, 64, 64, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 64, 64, 64, 66, 64, 64,
+	64, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 64, 64, 64, 64, 64,
+	64, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+	64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+};
+
 /*
  * Encode some data in base64.
  * inbuf points to the data
@@ -2154,32 +2247,44 @@ static const char base64_chars[] =
  * If true, newlines will be added after each group of 72 output bytes.
  * Returns: A freshly-allocated NUL-terminated string, containing the
  * base64 representation of the data. */
+// 12 bits at a time, two characters for each lookup
+static char base64_pairs[4096][2];
+
 char *base64Encode(const char *inbuf, int inlen, bool lines)
 {
 	char *out, *outstr;
-	uchar *in = (uchar *) inbuf;
-	int colno;
+	const uchar *in = (const uchar *)inbuf;
+	int colno, n;
+	unsigned w;
 	int outlen = ((inlen / 3) + 1) * 4;
 	++outlen;		/* zero on the end */
 	if (lines)
 		outlen += ((inlen / 54) + 1) * 2;
 	outstr = out = allocMem(outlen);
+	if (!base64_pairs[0][0]) {
+		for (n = 0; n < 4096; ++n) {
+			base64_pairs[n][0] = base64_chars[n >> 6];
+			base64_pairs[n][1] = base64_chars[n & 63];
+		}
+	}
 	colno = 0;
 	while (inlen >= 3) {
-		*out++ = base64_chars[(int)(*in >> 2)];
-		*out++ = base64_chars[(int)((*in << 4 | *(in + 1) >> 4) & 63)];
-		*out++ =
-		    base64_chars[(int)((*(in + 1) << 2 | *(in + 2) >> 6) & 63)];
-		*out++ = base64_chars[(int)(*(in + 2) & 63)];
-		inlen -= 3;
-		in += 3;
-		if (!lines)
-			continue;
-		colno += 4;
-		if (colno < 72)
-			continue;
-		*out++ = '\r', *out++ = '\n';
-		colno = 0;
+// as many groups of 3 as fit on the line, without testing the column each time
+		n = inlen / 3;
+		if (lines && n > (72 - colno) / 4)
+			n = (72 - colno) / 4;
+		inlen -= n * 3;
+		colno += n * 4;
+		for (; n; --n, in += 3) {
+			w = (unsigned)in[0] << 16 | (unsigned)in[1] << 8 | in[2];
+			memcpy(out, base64_pairs[w >> 12], 2);
+			memcpy(out + 2, base64_pairs[w & 0xfff], 2);
+			out += 4;
+		}
+		if (lines && colno >= 72) {
+			*out++ = '\r', *out++ = '\n';
+			colno = 0;
+		}
 	}
 	if (inlen == 1) {
 		*out++ = base64_chars[(int)(*in >> 2)];
@@ -2204,17 +2309,8 @@ char *base64Encode(const char *inbuf, int inlen, bool lines)
 
 uchar base64Bits(char c)
 {
-	if (isupperByte(c))
-		return c - 'A';
-	if (islowerByte(c))
-		return c - ('a' - 26);
-	if (isdigitByte(c))
-		return c - ('0' - 52);
-	if (c == '+')
-		return 62;
-	if (c == '/')
-		return 63;
-	return 64;		/* error */
+	uchar v = base64_vals[(uchar) c];
+	return v < 64 ? v : 64;		/* 64 is error */
 }
 
 /*********************************************************************
@@ -2242,6 +2338,25 @@ int base64Decode(char *start, char **end)
 	mod = 0;
 	equals = false;
 	for (q = r = start; q < b64_end; ++q) {
+// Between quanta, four digits in a row make three bytes.
+// That is nearly all of a base64 body; everything else takes the slow road.
+		if (mod == 0 && !equals) {
+			uchar a, b, d, e;
+			while (b64_end - q >= 4) {
+				a = base64_vals[(uchar) q[0]];
+				b = base64_vals[(uchar) q[1]];
+				d = base64_vals[(uchar) q[2]];
+				e = base64_vals[(uchar) q[3]];
+				if ((a | b | d | e) & 64)
+					break;
+				r[0] = (a << 2 | b >> 4);
+				r[1] = (b << 4 | d >> 2);
+				r[2] = (d << 6 | e);
+				r += 3, q += 4;
+			}
+			if (q == b64_end)
+				break;
+		}
 		c = *q;
 		if (isspaceByte(c))
 			continue;
@@ -2278,6 +2393,44 @@ int base64Decode(char *start, char **end)
 	return ret;
 }
 
+/*********************************************************************
+Decode quoted printable, in place, from start to end.
+=xx is a byte in hex, and = at the end of a line is a soft break.
+A null byte becomes a space, since we treat the result as a string.
+Text between the = signs is moved down in one piece.
+Returns the end of the decoded data.
+*********************************************************************/
+
+char *qpDecode(char *start, char *end)
+{
+	char c, d, *q, *r, *e;
+	for (q = r = start; q < end; ++q) {
+		e = memchr(q, '=', end - q);
+		if (!e)
+			e = end;
+		if (r != q)
+			memmove(r, q, e - q);
+		r += e - q;
+		if ((q = e) == end)
+			break;
+		c = *++q;
+		if (c == '\n')
+			continue;
+		d = q[1];
+		if (isxdigit(c) && isxdigit(d)) {
+			d = fromHex(c, d);
+			if (d == 0)
+				d = ' ';
+			*r++ = d;
+			++q;
+			continue;
+		}
+		--q;
+		*r++ = '=';
+	}
+	return r;
+}
+
 void
 iuReformat(const char *inbuf, int inbuflen, char **outbuf_p, int *outbuflen_p)
 {
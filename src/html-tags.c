@@ -173,63 +173,176 @@ But these only live in <head> if browseMail is true.
 {0, 0,0,0, 0},
 };
 
-static int isAutoclose(const char *name)
+/*********************************************************************
+Tag names are looked up all the time: newTag for every node on the page,
+and the scanner asks isWall, isInhead, isNonest, and so on, of every tag.
+Walking down availableTags and specialtags with a string compare at each step
+adds up on a page with 200,000 nodes.
+So all these names go into one hash table, built the first time we need it,
+holding the tagInfo, the specialtag, and the scanner bits for each name.
+The table is about 3 times the number of names, so probes are short.
+In case of duplicates, like map, the first entry wins, as in the linear walk.
+*********************************************************************/
+
+#define TB_NEXTCLOSE 1
+#define TB_CROSSCLOSE 2
+#define TB_CROSSCLOSE2 4
+#define TB_TABLESECTION 8
+#define TB_CELL 0x10
+#define TB_WALL 0x20
+
+static const char * const nextcloseList[] = {"title", "option", 0};
+static const char * const crosscloseList[] = {"h1","h2","h3","h4","h5","h6","p",0};
+static const char * const crossclose2List[] = {"h1","h2","h3","h4","h5","h6","table","ul","ol","dl","hr","div","form",0};
+static const char * const tablesectionList[] = {"thead","tbody","tfoot",0};
+static const char * const cellList[] = {"th","td",0};
+// space after these tags isn't significant
+static const char * const wallList[] = {"body","innerbody","innerhtml","title","h1","h2","h3","h4","h5","h6","p","table","thead","tbody","tfoot","tr","td","th","ul","ol","dl","li","dt","div","br","hr","iframe","option","optgroup","form",0};
+
+#define TAGSLOTS 512
+static struct tagslot {
+	const char *name; // lower case
+	const struct tagInfo *ti;
+	const struct specialtag *sp;
+	uchar bits;
+} tagslots[TAGSLOTS];
+static pthread_once_t tagslotsOnce = PTHREAD_ONCE_INIT;
+// upper case names, parallel to availableTags, for t->nodeNameU
+static char **tagUpper;
+
+static struct tagslot *tagSlot(const char *low, bool add)
+{
+	unsigned h = 0;
+	const char *s;
+	struct tagslot *y;
+	for (s = low; *s; ++s)
+		h = h * 33 + (uchar)*s;
+	h &= TAGSLOTS - 1;
+	while ((y = tagslots + h)->name) {
+		if (stringEqual(y->name, low))
+			return y;
+		h = (h + 1) & (TAGSLOTS - 1);
+	}
+	if (!add)
+		return 0;
+	y->name = low;
+	return y;
+}
+
+static void tagBitsFromList(const char * const *list, uchar bit)
+{
+	for (; *list; ++list)
+		tagSlot(*list, true)->bits |= bit;
+}
+
+static void buildTagSlots(void)
 {
+	const struct tagInfo *ti;
 	const struct specialtag *y;
-	for(y = specialtags; y->name; ++y)
-		if(stringEqual(name, y->name))
-			return y->autoclose;
-	return false;
+	struct tagslot *z;
+	int n;
+	for (ti = availableTags; ti->name[0]; ++ti) {
+		z = tagSlot(ti->name, true);
+		if (!z->ti)
+			z->ti = ti;
+	}
+	n = ti - availableTags;
+	tagUpper = allocMem(n * sizeof(char *));
+	for (ti = availableTags; ti->name[0]; ++ti) {
+		char *u = cloneString(ti->name);
+		caseShift(u, 'u');
+		tagUpper[ti - availableTags] = u;
+	}
+	for (y = specialtags; y->name; ++y) {
+		z = tagSlot(y->name, true);
+		if (!z->sp)
+			z->sp = y;
+	}
+	tagBitsFromList(nextcloseList, TB_NEXTCLOSE);
+	tagBitsFromList(crosscloseList, TB_CROSSCLOSE);
+	tagBitsFromList(crossclose2List, TB_CROSSCLOSE2);
+	tagBitsFromList(tablesectionList, TB_TABLESECTION);
+	tagBitsFromList(cellList, TB_CELL);
+	tagBitsFromList(wallList, TB_WALL);
+}
+
+// name can be upper or lower case, as in <P> or createElement("Div")
+static const struct tagslot *findTagSlot(const char *name)
+{
+	char low[MAXTAGNAME];
+	int i;
+	pthread_once(&tagslotsOnce, buildTagSlots);
+	for (i = 0; name[i]; ++i) {
+		if (i == MAXTAGNAME - 1)
+			return 0;
+		low[i] = tolower((uchar)name[i]);
+	}
+	low[i] = 0;
+	return tagSlot(low, false);
+}
+
+const struct tagInfo *tagInfoByName(const char *name)
+{
+	const struct tagslot *z = findTagSlot(name);
+	return z ? z->ti : 0;
+}
+
+static const struct specialtag *findSpecial(const char *name)
+{
+	const struct tagslot *z = findTagSlot(name);
+	return z ? z->sp : 0;
+}
+
+static bool hasTagBit(const char *name, uchar bit)
+{
+	const struct tagslot *z = findTagSlot(name);
+	return z && (z->bits & bit);
+}
+
+static int isAutoclose(const char *name)
+{
+	const struct specialtag *y = findSpecial(name);
+	return y ? y->autoclose : false;
 }
 
 static int isInhead(const char *name)
 {
-	const struct specialtag *y;
-	for(y = specialtags; y->name; ++y)
-		if(stringEqual(name, y->name)) {
-			uchar c = y->inhead;
-			if(c == 2 && !browseMail) c = 0;
-			return c;
-		}
-	return false;
+	const struct specialtag *y = findSpecial(name);
+	uchar c;
+	if(!y) return false;
+	c = y->inhead;
+	if(c == 2 && !browseMail) c = 0;
+	return c;
 }
 
 static int isNextclose(const char *name)
 {
-// there are so few of these; may as well just make a list
-	static const char * const list[] = {"title", "option", 0};
-	return stringInList(list, name) >= 0;
+	return hasTagBit(name, TB_NEXTCLOSE);
 }
 
 static int isCrossclose(const char *name)
 {
-	static const char * const list[] = {"h1","h2","h3","h4","h5","h6","p",0};
-	return stringInList(list, name) >= 0;
+	return hasTagBit(name, TB_CROSSCLOSE);
 }
 
 static int isCrossclose2(const char *name)
 {
-	static const char * const list[] = {"h1","h2","h3","h4","h5","h6","table","ul","ol","dl","hr","div","form",0};
-	return stringInList(list, name) >= 0;
+	return hasTagBit(name, TB_CROSSCLOSE2);
 }
 
 static int isTableSection(const char *name)
 {
-	static const char * const list[] = {"thead","tbody","tfoot",0};
-	return stringInList(list, name) >= 0;
+	return hasTagBit(name, TB_TABLESECTION);
 }
 
 static int isCell(const char *name)
 {
-	static const char * const list[] = {"th","td",0};
-	return stringInList(list, name) >= 0;
+	return hasTagBit(name, TB_CELL);
 }
 
-// space after these tags isn't significant
 static int isWall(const char *name)
 {
-	static const char * const list[] = {"body","innerbody","innerhtml","title","h1","h2","h3","h4","h5","h6","p","table","thead","tbody","tfoot","tr","td","th","ul","ol","dl","li","dt","div","br","hr","iframe","option","optgroup","form",0};
-	return stringInList(list, name) >= 0;
+	return hasTagBit(name, TB_WALL);
 }
 
 
@@ -239,10 +352,7 @@ static int isNonest(const char *name, const struct opentag *k)
 	const char *s, *t;
 	char watch[MAXTAGNAME];
 	const struct opentag *l;
-	for(y = specialtags; y->name; ++y)
-		if(stringEqual(name, y->name))
-			break;
-	if(!y->name) return true;
+	if(!(y = findSpecial(name))) return true;
 	if(y->nestable) return false;
 // td can be inside td, if there is table in between,
 // second indicates this in-between tag
@@ -391,31 +501,183 @@ past_html_close_semantics:
 	}
 }
 
+/*********************************************************************
+Tags come from a per-window arena, rather than one malloc at a time.
+A page can have 200,000 tags, each with a name, an upper case name,
+two arrays of attributes, and a string for each attribute name,
+and every one of those was a separate malloc, and a separate free
+when we leave the page.
+Now tags come from slabs of TAGSLAB, attribute names are stored once
+per window in a string pool, and it all goes away in freeTags.
+Known tag names point to the names in availableTags, or to tagUpper,
+and are never freed.
+The two attribute arrays share one allocation that grows by doubling.
+Attribute values are still allocated on their own, since the caller
+passes them in, and javascript replaces them.
+backupTags returns dead tags to a free list, which newTag uses first,
+so innerHTML running every 5 seconds doesn't grow the arena.
+*********************************************************************/
+
+#define TAGSLAB 256
+struct tagSlab {
+	struct tagSlab *next;
+	int used;
+	Tag tags[TAGSLAB];
+};
+
+#define POOLCHUNK 4096
+struct poolChunk {
+	struct poolChunk *next;
+	int used, size;
+	char text[];
+};
+
+struct attrName {
+	struct attrName *next;
+	char name[];
+};
+
+#define ATTRBUCKETS 256
+struct tagArena {
+	struct tagSlab *slabs;
+	Tag *freelist; // linked through t->same
+	struct poolChunk *pool;
+	struct attrName *names[ATTRBUCKETS];
+};
+
+static struct tagArena *windowArena(Window *w)
+{
+	if (!w->tagArena)
+		w->tagArena = allocZeroMem(sizeof(struct tagArena));
+	return w->tagArena;
+}
+
+static Tag *tagAlloc(Window *w)
+{
+	struct tagArena *a = windowArena(w);
+	struct tagSlab *b = a->slabs;
+	Tag *t;
+	if ((t = a->freelist)) {
+		a->freelist = t->same;
+		memset(t, 0, sizeof(Tag));
+		return t;
+	}
+	if (!b || b->used == TAGSLAB) {
+		b = allocMem(sizeof(struct tagSlab));
+		b->used = 0;
+		b->next = a->slabs;
+		a->slabs = b;
+	}
+	t = b->tags + b->used++;
+	memset(t, 0, sizeof(Tag));
+	return t;
+}
+
+static void *poolAlloc(struct tagArena *a, int n)
+{
+	struct poolChunk *c = a->pool;
+	void *p;
+	n = (n + 7) & ~7;
+	if (!c || c->used + n > c->size) {
+		int size = (n > POOLCHUNK ? n : POOLCHUNK);
+		c = allocMem(sizeof(struct poolChunk) + size);
+		c->used = 0;
+		c->size = size;
+		c->next = a->pool;
+		a->pool = c;
+	}
+	p = c->text + c->used;
+	c->used += n;
+	return p;
+}
+
+// Attribute names are shared by all the tags in the window.
+static const char *attrName(Window *w, const char *name)
+{
+	struct tagArena *a = windowArena(w);
+	struct attrName *z;
+	unsigned h = 0;
+	const char *s;
+	int l;
+	for (s = name; *s; ++s)
+		h = h * 33 + (uchar)*s;
+	h &= ATTRBUCKETS - 1;
+	for (z = a->names[h]; z; z = z->next)
+		if (stringEqual(z->name, name))
+			return z->name;
+	l = s - name;
+	z = poolAlloc(a, sizeof(struct attrName) + l + 1);
+	memcpy(z->name, name, l + 1);
+	z->next = a->names[h];
+	a->names[h] = z;
+	return z->name;
+}
+
+static void freeArena(Window *w)
+{
+	struct tagArena *a = w->tagArena;
+	struct tagSlab *b;
+	struct poolChunk *c;
+	if (!a)
+		return;
+	while ((b = a->slabs)) {
+		a->slabs = b->next;
+		free(b);
+	}
+	while ((c = a->pool)) {
+		a->pool = c->next;
+		free(c);
+	}
+	free(a);
+	w->tagArena = 0;
+}
+
+// Is this one of the shared names set up in newTag?
+static bool internedName(const Tag *t, const char *s)
+{
+	return s == t->info->name || s == tagUpper[t->info - availableTags];
+}
+
+// capacity of the attribute arrays holding n entries and the terminating null
+static int attrCapacity(int n)
+{
+	int cap = 4;
+	while (cap < n + 1)
+		cap *= 2;
+	return cap;
+}
+
 static void pushTag(Tag *t);
 Tag *newTag(const Frame *f, const char *name)
 {
 	Tag *t, *t1, *t2 = 0;
 	const struct tagInfo *ti;
 	static int gsn = 0;
-
-	for (ti = availableTags; ti->name[0]; ++ti)
-		if (stringEqualCI(ti->name, name))
-			break;
-
-	if (!ti->name[0]) {
+	char *up;
+
+	t = tagAlloc(cw);
+	if ((ti = tagInfoByName(name))) {
+		up = tagUpper[ti - availableTags];
+		t->nodeNameU = up;
+		if (stringEqual(name, ti->name))
+			t->nodeName = (char *)ti->name;
+		else if (stringEqual(name, up))
+			t->nodeName = up;
+		else
+			t->nodeName = cloneString(name);
+	} else {
 		debugPrint(4, "warning, created node %s reverts to generic", name);
 		ti = availableTags;
+		t->nodeName = cloneString(name);
+		t->nodeNameU = cloneString(name);
+		caseShift(t->nodeNameU, 'u');
 	}
 
-	t = (Tag *)allocZeroMem(sizeof(Tag));
 	t->action = ti->action;
 	t->f0 = (Frame *) f;		/* set owning frame */
 	t->info = ti;
 	t->seqno = cw->numTags;
 	t->gsn = ++gsn;
-	t->nodeName = cloneString(name);
-	t->nodeNameU = cloneString(name);
-	caseShift(t->nodeNameU, 'u');
 	pushTag(t);
 	if (t->action == TAGACT_SCRIPT) {
 		for (t1 = cw->scriptlist; t1; t1 = t1->same)
@@ -507,7 +769,12 @@ stop:
 		if(t->action == TAGACT_PRE && t->slash
 		&& !tagList[cw->numTags-2]->dead)
 			goto stop;
+// a datalist could still be on the seldirty list
+		if(t->seldirty)
+			goto stop;
 		freeTag(t);
+		t->same = cw->tagArena->freelist;
+		cw->tagArena->freelist = t;
 		--cw->numTags, ++n;
 	}
 	if(delmessage) debugPrint(5, "stop at live after %d", n);
@@ -680,8 +947,10 @@ static void freeTag(Tag *t)
 	nzFree(t->name);
 	nzFree(t->id);
 	nzFree(t->jclass);
-	nzFree(t->nodeName);
-	nzFree(t->nodeNameU);
+	if (!internedName(t, t->nodeName))
+		nzFree(t->nodeName);
+	if (!internedName(t, t->nodeNameU))
+		nzFree(t->nodeNameU);
 	nzFree(t->value);
 	cnzFree(t->rvalue);
 	nzFree(t->href);
@@ -689,25 +958,15 @@ static void freeTag(Tag *t)
 	nzFree(t->innerHTML);
 	nzFree(t->custom_h);
 
-	a = (char **)t->attributes;
-	if (a) {
-		while (*a) {
-			nzFree(*a);
-			++a;
-		}
-		free(t->attributes);
-	}
-
+// attribute names live in the arena, and atvals is in the same block
 	a = (char **)t->atvals;
 	if (a) {
 		while (*a) {
 			nzFree(*a);
 			++a;
 		}
-		free(t->atvals);
+		free(t->attributes);
 	}
-
-	free(t);
 }
 
 void freeTags(Window *w)
@@ -737,8 +996,11 @@ void freeTags(Window *w)
 
 	free(w->tags);
 	w->tags = 0;
+	freeArena(w);
+	w->rrhash = w->rrfhash = 0;
 	w->numTags = w->allocTags = w->deadTags = 0;
 	w->inputlist = w->scriptlist = w->optlist = w->linklist = 0;
+	w->seldirty = 0;
 	w->framelist = 0;
 }
 
@@ -1575,16 +1837,19 @@ void setTagAttr(Tag *t, const char *name, char *val)
 		t->atvals[i] = val;
 		return;
 	}
-/* push */
-	if (!nattr) {
-		t->attributes = allocMem(sizeof(char *) * 2);
-		t->atvals = allocMem(sizeof(char *) * 2);
-	} else {
-		t->attributes =
-		    reallocMem(t->attributes, sizeof(char *) * (nattr + 2));
-		t->atvals = reallocMem(t->atvals, sizeof(char *) * (nattr + 2));
+/* push, names and values share one block, see the arena notes above */
+	if (!nattr || attrCapacity(nattr + 1) > attrCapacity(nattr)) {
+		int cap = attrCapacity(nattr + 1);
+		const char **b = allocMem(sizeof(char *) * 2 * cap);
+		if (t->attributes) {
+			memcpy(b, t->attributes, sizeof(char *) * nattr);
+			memcpy(b + cap, t->atvals, sizeof(char *) * nattr);
+			free(t->attributes);
+		}
+		t->attributes = b;
+		t->atvals = b + cap;
 	}
-	t->attributes[nattr] = cloneString(name);
+	t->attributes[nattr] = attrName(t->f0->owner, name);
 	t->atvals[nattr] = val;
 	++nattr;
 	t->attributes[nattr] = 0;
@@ -3704,40 +3969,87 @@ static unsigned andLookup(char *entity, char *v)
 	return 0; // not found
 }
 
-// Here is a general routine to traverse the tree, with a callback function.
-nodeFunction traverse_callback;
-static bool treeOverflow;
+/*********************************************************************
+Here is a general routine to traverse the tree, with a callback function.
+This does not recurse; some framework pages nest divs thousands deep.
+The stack holds the open tags, just as the recursive calls did,
+and we read firstchild after the open callback and sibling after the close,
+so a callback can still change the tree below or beside the current node.
+Each traversal has a generation number, stamped on the tags it reaches,
+so a malformed tree with a cycle doesn't loop forever,
+and we don't have to clear a visited flag on every tag beforehand.
+The stack, the generation, and the callback belong to the call,
+so a callback can start a traversal of its own.
+The stack starts out local, and moves to the heap if the tree is deep.
+*********************************************************************/
+
+static unsigned travgen;
 
-static void traverseNode(Tag *node)
+#define TRAVLOCAL 256
+// returns true if the tree is malformed
+static bool traverseNode(Tag *node, nodeFunction fn, unsigned gen)
 {
-	Tag *child;
-	if (node->visited) {
-		treeOverflow = true;
-		debugPrint(4, "node revisit %s %d", node->info->name, node->seqno);
-		return;
+	Tag *local[TRAVLOCAL];
+	Tag **stack = local;
+	int depth = 0, max = TRAVLOCAL;
+	bool overflow = false;
+	Tag *t;
+
+	while (true) {
+		if (node) {
+			if (node->visitgen == gen) {
+				overflow = true;
+				debugPrint(4, "node revisit %s %d", node->info->name, node->seqno);
+				node = (depth ? node->sibling : 0);
+				continue;
+			}
+			node->visitgen = gen;
+			(*fn) (node, true);
+			if (depth == max) {
+				if (stack == local) {
+					stack = allocMem(max * 2 * sizeof(Tag *));
+					memcpy(stack, local, max * sizeof(Tag *));
+				} else
+					stack = reallocMem(stack, max * 2 * sizeof(Tag *));
+				max *= 2;
+			}
+			stack[depth++] = node;
+			node = node->firstchild;
+			continue;
+		}
+		if (!depth)
+			break;
+		t = stack[--depth];
+		(*fn) (t, false);
+		node = (depth ? t->sibling : 0);
 	}
-	node->visited = true;
-	(*traverse_callback) (node, true);
-	for (child = node->firstchild; child; child = child->sibling)
-		traverseNode(child);
-	(*traverse_callback) (node, false);
+
+	if (stack != local)
+		free(stack);
+	return overflow;
 }
 
-void traverseAll(void)
+void traverseAll(nodeFunction fn)
 {
 	Tag *t;
 	int i;
-	treeOverflow = false;
-	for (i = 0; i < cw->numTags; ++i)
-		tagList[i]->visited = false;
+	unsigned gen;
+	bool overflow = false;
+	if (!++travgen) {
+// wrapped around, old stamps could match
+		for (i = 0; i < cw->numTags; ++i)
+			tagList[i]->visitgen = 0;
+		travgen = 1;
+	}
+	gen = travgen;
 	for (i = 0; i < cw->numTags; ++i) {
 		t = tagList[i];
 		if (!t->parent && !t->dead) {
 			debugPrint(6, "traverse start at %s %d", t->info->name, t->seqno);
-			traverseNode(t);
+			overflow |= traverseNode(t, fn, gen);
 		}
 	}
-	if (treeOverflow)
+	if (overflow)
 		debugPrint(3, "malformed tree!");
 }
 
@@ -4402,8 +4714,7 @@ currentAudio = NULL;
 	optg = NULL;
 	nzFree(radioCheck);
 	radioCheck = 0;
-	traverse_callback = prerenderNode;
-	traverseAll();
+	traverseAll(prerenderNode);
 	currentForm = NULL;
 	nzFree(radioCheck);
 	radioCheck = 0;
@@ -4958,8 +5269,7 @@ void decorate(void)
 		set_property_bool_doc(cf, "eb$xml", true);
 		set_property_string_doc(cf, "dom$class", "XMLDocument");
 	}
-	traverse_callback = jsNode;
-	traverseAll();
+	traverseAll(jsNode);
 }
 
 /*********************************************************************
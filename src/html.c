@@ -270,9 +270,12 @@ This is required before running any javascript, e.g. an onclick function.
 After all, the input fields may have changed.
 You may have changed the last name from Flintstone to Rubble.
 This has to propagate down to the javascript strings in the DOM.
-This is quick and stupid; I just update everything.
-Most of the time I'm setting the strings to what they were before;
-that's the way it goes.
+We only push the fields that differ from what javascript already holds.
+t->value tracks the js side, because the value setter calls domSetsTagValue.
+t->checked is read back from js at render, and can be trusted
+unless js has checked or unchecked that box since, marked by t->jschecked.
+So if the buffer agrees with the tag, you didn't touch that field,
+and there's no need for a round trip into js for each of 500 inputs.
 *********************************************************************/
 
 void jSyncup(bool fromtimer, const Tag *active)
@@ -302,10 +305,11 @@ void jSyncup(bool fromtimer, const Tag *active)
 
 		if (itype >= INP_RADIO) {
 			int checked = fieldIsChecked(t->seqno);
-			if (checked < 0)
+			if (checked < 0 || (checked == t->checked && !t->jschecked))
 				continue;
 			t->checked = checked;
 			set_property_bool_t(t, "checked", checked);
+			t->jschecked = false;
 			continue;
 		}
 
@@ -316,6 +320,11 @@ void jSyncup(bool fromtimer, const Tag *active)
 		if (!value)
 			continue;
 
+		if (stringEqual(value, t->value) && !(itype == INP_TA && t->lic >= 0)) {
+			nzFree(value);
+			continue;
+		}
+
 		if (itype == INP_SELECT) {
 // set option.selected in js based on the option(s) in value
 			locateOptions(t, (value ? value : t->value), 0, 0, true);
@@ -339,8 +348,13 @@ void jSyncup(bool fromtimer, const Tag *active)
 // unfoldBuffer could fail if we have quit that session.
 				if (!unfoldBuffer(cx, false, &cxbuf, &j))
 					continue;
+				if (stringEqual(cxbuf, t->value)) {
+					nzFree(cxbuf);
+					continue;
+				}
 				set_property_string_t(t, "value", cxbuf);
-				nzFree(cxbuf);
+				nzFree(t->value);
+				t->value = cxbuf;
 				continue;
 			}
 		}
@@ -806,7 +820,7 @@ void prepareScript(Tag *t)
 			nzFree(h);
 		} else {
 			struct i_get g;
-			bool jsbg = down_jsbg;
+			bool jsbg = down_jsbg, rc;
 			const Tag *u;
 
 // this has to happen before threads spin off
@@ -847,7 +861,9 @@ void prepareScript(Tag *t)
 			g.thisfile = f->fileName;
 			g.uriEncoded = true;
 			g.url = realsource;
-			if (!httpConnect(&g)) {
+			if (!preloadClaim(&g, &rc))
+				rc = httpConnect(&g);
+			if (!rc) {
 				if (debugLevel >= 3)
 					i_printf(MSG_GetJS2);
 				goto fail;
@@ -1167,7 +1183,9 @@ I will disconnect here, and also check for inxhr in runOnload().
 		if (!ln)
 			ln = 1;
 		debugPrint(3, "exec %s at %d", js_file, ln);
+		n = profBegin("script");
 		jsRunData(t, js_file, ln);
+		profEnd(n, js_file);
 		debugPrint(3, "exec complete");
 
 afterscript:
@@ -1287,6 +1305,7 @@ static bool jsDoorway(void)
 char *htmlParse(char *buf, int remote)
 {
 	char *a, *newbuf;
+	int pn;
 
 	if (tagList)
 		i_printfExit(MSG_HtmlNotreentrant);
@@ -1297,9 +1316,13 @@ char *htmlParse(char *buf, int remote)
 	cf->hbase = cloneString(cf->fileName);
 
 	debugPrint(3, "parse html from browse");
+	pn = profBegin("scan");
 	htmlScanner(buf, NULL, false);
+	profEnd(pn, 0);
 	nzFree(buf);
+	pn = profBegin("prerender");
 	prerender();
+	profEnd(pn, 0);
 
 /* if the html doesn't use javascript, then there's
  * no point in generating it.
@@ -1309,25 +1332,37 @@ char *htmlParse(char *buf, int remote)
 		freeJSContext(cf);
 
 	if (isJSAlive) {
+		pn = profBegin("decorate");
 		decorate();
+		profEnd(pn, 0);
 		set_basehref(cf->hbase);
 		if(cf->xmlMode) goto past_html_events;
 		run_function_bool_win(cf, "eb$qs$start");
+		pn = profBegin("scripts");
 		runScriptsPending(true);
+		profEnd(pn, 0);
+		pn = profBegin("onload");
 		runOnload();
 		runScriptsPending(false);
 		run_function_bool_win(cf, "readyStateComplete");
 		run_event_win(cf, "window", "onfocus");
 		run_event_doc(cf, "document", "onfocus");
 		runScriptsPending(false);
+		profEnd(pn, 0);
+		pn = profBegin("selectors");
 		rebuildSelectors();
+		profEnd(pn, 0);
 	}
 past_html_events:
 	debugPrint(3, "end parse html from browse");
 
+	pn = profBegin("render");
 	a = render();
+	profEnd(pn, 0);
 	debugPrint(6, "|%s|\n", a);
+	pn = profBegin("reformat");
 	newbuf = htmlReformat(a);
+	profEnd(pn, 0);
 	nzFree(a);
 
 	return newbuf;
@@ -1373,10 +1408,8 @@ bool htmlTest(void)
 			look[j - 1] = 0;
 			if (j > 1 && (p[j] == '>' || isspaceByte(p[j]))) {
 /* something we recognize? */
-				const struct tagInfo *ti;
-				for (ti = availableTags; ti->name[0]; ++ti)
-					if (stringEqualCI(ti->name, look))
-						return true;
+				if (tagInfoByName(look))
+					return true;
 			}	/* leading tag */
 		}		/* leading < */
 		firstline = false;
@@ -1419,6 +1452,229 @@ bool htmlTest(void)
 	return (cnt >= 4 && cnt * 300 >= fsize);
 }
 
+/*********************************************************************
+Page load profiler.
+Spans of time, on the monotonic clock, around each phase of a browse:
+the fetch, the html scanner, prerender, css, the js context, scripts,
+decorate, render, and reformat.
+Spans nest, so the scripts inside runScriptsPending are counted there,
+and again one by one, with the file name as detail.
+The list starts over when a new page is fetched or browsed;
+frames that are expanded later add to it.
+It's a pair of clock reads per phase, so it is always on.
+Each span also counts the calls to allocMem and friends, see allocTotal.
+The prof command prints a summary, and prof file writes the spans
+as chrome trace events, for chrome://tracing or perfetto.
+*********************************************************************/
+
+struct profspan {
+	const char *name;
+	char *detail;
+	long long start, dur;	// microseconds
+	long long allocs;
+	int depth;
+};
+
+#define MAXPROF 4096
+static struct profspan profspans[MAXPROF];
+static int nprof, profdepth;
+static long long profbase;
+static char *profurl;
+static bool profFetched;
+
+static long long profNow(void)
+{
+#ifdef _MSC_VER
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#endif
+}
+
+// Start a new profile, unless we just fetched this page and are now browsing it.
+void profReset(const char *url, bool fetching)
+{
+	int i;
+	if (!fetching && profFetched) {
+		profFetched = false;
+		return;
+	}
+	profFetched = fetching;
+	for (i = 0; i < nprof; ++i)
+		nzFree(profspans[i].detail);
+	nprof = profdepth = 0;
+	nzFree(profurl);
+	profurl = cloneString(url);
+	profbase = profNow();
+}
+
+// returns a handle for profEnd, -1 if the table is full
+int profBegin(const char *name)
+{
+	struct profspan *p;
+	++profdepth;
+	if (nprof == MAXPROF)
+		return -1;
+	p = profspans + nprof;
+	p->name = name;
+	p->detail = 0;
+	p->depth = profdepth - 1;
+	p->start = profNow() - profbase;
+	p->dur = -1;
+	p->allocs = allocTotal();
+	return nprof++;
+}
+
+void profEnd(int n, const char *detail)
+{
+	struct profspan *p;
+	if (profdepth)
+		--profdepth;
+	if (n < 0)
+		return;
+	p = profspans + n;
+	p->dur = profNow() - profbase - p->start;
+	p->allocs = allocTotal() - p->allocs;
+	if (detail)
+		p->detail = cloneString(detail);
+}
+
+static void jsonString(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		if ((uchar) * s < ' ')
+			fprintf(f, "\\u%04x", (uchar) * s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void profTrace(FILE *f)
+{
+	int i;
+	const struct profspan *p;
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (i = 0; i < nprof; ++i) {
+		p = profspans + i;
+		fprintf(f, "{\"name\":");
+		jsonString(f, p->name);
+		fprintf(f, ",\"cat\":\"edbrowse\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%lld",
+			p->start, (p->dur < 0 ? 0 : p->dur));
+		fprintf(f, ",\"args\":{\"allocs\":%lld",
+			(p->dur < 0 ? 0 : p->allocs));
+		if (p->detail) {
+			fprintf(f, ",\"detail\":");
+			jsonString(f, p->detail);
+		}
+		fprintf(f, "}}%s\n", (i < nprof - 1 ? "," : ""));
+	}
+	fprintf(f, "],\"otherData\":{\"url\":");
+	jsonString(f, (profurl ? profurl : ""));
+	fprintf(f, "}}\n");
+}
+
+/*********************************************************************
+prof with no argument prints the total time and allocations in each phase,
+in the order the phases first ran, then the slowest scripts.
+Only the outermost span of a name is added in, so a phase that
+calls itself, like a frame within a frame, isn't counted twice.
+prof file writes the trace.
+*********************************************************************/
+
+#define PROFSCRIPTS 10
+bool profCommand(const char *file)
+{
+	int i, j, k, nnames = 0;
+	const char *names[64];
+	long long total[64], allocs[64];
+	int count[64];
+	int slow[PROFSCRIPTS], nslow = 0;
+	const struct profspan *p;
+	bool nested;
+
+	if (file) {
+		FILE *f = fopen(file, "w");
+		if (!f) {
+			setError(MSG_NoCreate2, file, strerror(errno));
+			return false;
+		}
+		profTrace(f);
+		fclose(f);
+		return true;
+	}
+
+	if (!nprof) {
+		i_puts(MSG_Empty);
+		return true;
+	}
+	printf("%s\n", (profurl ? profurl : "no file"));
+
+	for (i = 0; i < nprof; ++i) {
+		p = profspans + i;
+		if (p->dur < 0)
+			continue;
+// is there an enclosing span of the same name?
+		nested = false;
+		for (j = i - 1, k = p->depth; j >= 0 && k > 0; --j) {
+			if (profspans[j].depth >= k)
+				continue;
+			k = profspans[j].depth;
+			if (stringEqual(profspans[j].name, p->name)) {
+				nested = true;
+				break;
+			}
+		}
+		for (j = 0; j < nnames && !nested; ++j)
+			if (stringEqual(names[j], p->name))
+				break;
+		if (!nested && j == nnames && nnames < 64) {
+			names[nnames] = p->name;
+			total[nnames] = 0;
+			allocs[nnames] = 0;
+			count[nnames] = 0;
+			++nnames;
+		}
+		if (!nested && j < nnames) {
+			total[j] += p->dur;
+			allocs[j] += p->allocs;
+			++count[j];
+		}
+
+		if (!stringEqual(p->name, "script"))
+			continue;
+// keep the slowest scripts, in order
+		if (nslow == PROFSCRIPTS && profspans[slow[nslow - 1]].dur >= p->dur)
+			continue;
+		if (nslow < PROFSCRIPTS)
+			++nslow;
+		for (j = nslow - 1; j > 0 && profspans[slow[j - 1]].dur < p->dur; --j)
+			slow[j] = slow[j - 1];
+		slow[j] = i;
+	}
+
+	for (j = 0; j < nnames; ++j) {
+		printf("%-12s %8.1f ms %8lld allocs", names[j], total[j] / 1000.0,
+		       allocs[j]);
+		if (count[j] > 1)
+			printf(" %d times", count[j]);
+		nl();
+	}
+	for (j = 0; j < nslow; ++j) {
+		p = profspans + slow[j];
+		printf("script %8.1f ms %s\n", p->dur / 1000.0,
+		       (p->detail ? p->detail : "?"));
+	}
+	return true;
+}
+
 bool browseCurrentBuffer(const char *suffix, bool plain)
 {
 	char *rawbuf, *newbuf = 0, *tbuf;
@@ -1430,6 +1686,7 @@ bool browseCurrentBuffer(const char *suffix, bool plain)
 	const struct MIMETYPE *mt = 0;
 
 	remote = isURL(cf->fileName);
+	profReset(cf->fileName, false);
 
 	debugPrint(4, "browseCurrent suffix %s plain %d render %d%d%d imap %d remote %d",
 	suffix, plain,
@@ -1563,8 +1820,11 @@ bool browseCurrentBuffer(const char *suffix, bool plain)
 	}
 
 	if (bmode == 2) {
-		if (javaOK(cf->fileName))
+		if (javaOK(cf->fileName)) {
+			int pn = profBegin("js context");
 			createJSContext(cf);
+			profEnd(pn, 0);
+		}
 		nzFree(newlocation);	/* should already be 0 */
 		newlocation = 0;
 		newbuf = htmlParse(rawbuf, remote);
@@ -3126,7 +3386,6 @@ past a one line anomaly.
 
 static int sameFront, sameBack1, sameBack2;
 static int front1z, front2z, back1z, back2z;
-static const char *newChunkStart, *newChunkEnd;
 
 // need a reverse strchr to help us out.
 static const char *rstrchr(const char *s, const char *mark)
@@ -3193,7 +3452,7 @@ static void frontBackDiff(const char *b1, const char *b2)
 		}
 		if (!*s1 && !*s2) {
 			front1z = front2z = 0;
-			goto done;
+			return;
 		}
 	}
 
@@ -3235,7 +3494,7 @@ mark_e:
 			--front1z, --front2z;
 		if (front1z <= sameFront || front2z <= sameFront)
 			front1z = front2z = 0;
-		goto done;
+		return;
 	}
 
 	h1 = rstrchr(e1, f1);
@@ -3267,10 +3526,187 @@ mark_e:
 			--s1, --s2;
 		}
 	}
+}
 
-done:
-	newChunkStart = f2;
-	newChunkEnd = e2;
+/*********************************************************************
+The front back diff is fine for reporting what changed,
+since we only talk about one region anyways,
+but it is a poor way to patch the buffer.
+A change at the top and another at the bottom replaces everything between.
+So the buffer is patched by a real line diff, Myers' O(ND) algorithm,
+on the lines that remain after the common front and back are trimmed.
+Lines are compared by hash, then by content.
+If the screens are wildly different, more than MAXD edits,
+give up and replace the middle as one block, as we did before.
+The trace holds a v array for each edit distance, 2d+1 ints for d,
+so it grows as the search goes deeper; MAXD edits is about a megabyte.
+*********************************************************************/
+
+struct rline {
+	const char *s;
+	int len;		// including the newline
+	unsigned hash;
+};
+
+#define MAXD 500
+
+static struct rline *splitLines(const char *b, int *np)
+{
+	int n = 0, j;
+	const char *s;
+	struct rline *a;
+	for (s = b; *s; ++s)
+		if (*s == '\n')
+			++n;
+	if (s > b && s[-1] != '\n')
+		++n;
+	a = allocMem((n + 1) * sizeof(struct rline));
+	for (s = b, j = 0; j < n; ++j) {
+		unsigned h = 2166136261u;
+		a[j].s = s;
+		while (*s && *s != '\n')
+			h = (h ^ (uchar) * s++) * 16777619;
+		if (*s)
+			++s;
+		a[j].len = s - a[j].s;
+		a[j].hash = h;
+	}
+	*np = n;
+	return a;
+}
+
+static bool sameLine(const struct rline *x, const struct rline *y)
+{
+	return x->hash == y->hash && x->len == y->len &&
+	    !memcmp(x->s, y->s, x->len);
+}
+
+// Mark the deleted lines of a and the inserted lines of b.
+// Returns false if there are more than MAXD edits.
+static bool myers(const struct rline *a, int n, const struct rline *b, int m,
+		  char *adel, char *bins)
+{
+	int maxd = n + m, d, k, x, y;
+	int *trace, *v, *pv;
+	int room = 64;
+	if (maxd > MAXD)
+		maxd = MAXD;
+	trace = allocMem(room * sizeof(int));
+// v for edit distance d is at trace + d*d, indexed by k + d
+	for (d = 0; d <= maxd; ++d) {
+		if ((d + 1) * (d + 1) > room) {
+			room *= 2;
+			if (room < (d + 1) * (d + 1))
+				room = (d + 1) * (d + 1);
+			trace = reallocMem(trace, room * sizeof(int));
+		}
+		v = trace + d * d;
+		pv = trace + (d - 1) * (d - 1) - 1;	// indexed by k + d
+		for (k = -d; k <= d; k += 2) {
+			if (!d)
+				x = 0;
+			else if (k == -d || (k != d && pv[k - 1 + d] < pv[k + 1 + d]))
+				x = pv[k + 1 + d];
+			else
+				x = pv[k - 1 + d] + 1;
+			y = x - k;
+			while (x < n && y < m && sameLine(a + x, b + y))
+				++x, ++y;
+			v[k + d] = x;
+			if (x >= n && y >= m)
+				goto found;
+		}
+	}
+	free(trace);
+	return false;
+
+found:
+// walk back through the trace
+	x = n, y = m;
+	for (; d > 0; --d) {
+		int px, pk;
+		k = x - y;
+		pv = trace + (d - 1) * (d - 1) - 1;
+		if (k == -d || (k != d && pv[k - 1 + d] < pv[k + 1 + d])) {
+			pk = k + 1;
+			px = pv[pk + d];
+			bins[px - pk] = 1;
+		} else {
+			pk = k - 1;
+			px = pv[pk + d];
+			adel[px] = 1;
+		}
+		x = px, y = px - pk;
+	}
+	free(trace);
+	return true;
+}
+
+/*********************************************************************
+Patch the buffer, which holds the old screen b1, into the new screen b2.
+Hunks are applied bottom up, so the line numbers above are still good.
+Returns where dot should go if its line, wasdot, was deleted or replaced.
+*********************************************************************/
+
+static int patchLines(const char *b1, const char *b2, int wasdot)
+{
+	struct rline *a, *b;
+	int n, m, front, back, i, j, i1, j1;
+	char *adel, *bins;
+	int dotfall = 0;
+
+	a = splitLines(b1, &n);
+	b = splitLines(b2, &m);
+	for (front = 0; front < n && front < m; ++front)
+		if (!sameLine(a + front, b + front))
+			break;
+	for (back = 0; back < n - front && back < m - front; ++back)
+		if (!sameLine(a + n - 1 - back, b + m - 1 - back))
+			break;
+
+	adel = allocZeroMem(n + 1);
+	bins = allocZeroMem(m + 1);
+	if (!myers(a + front, n - front - back, b + front, m - front - back,
+		   adel + front, bins + front)) {
+		debugPrint(4, "rerender diff gives up at %d edits", MAXD);
+		memset(adel + front, 1, n - front - back);
+		memset(bins + front, 1, m - front - back);
+	}
+
+	i = n - back, j = m - back;
+	while (i > front || j > front) {
+		if (i > front && j > front && !adel[i - 1] && !bins[j - 1]) {
+			--i, --j;
+			continue;
+		}
+// a hunk ends here, find its start
+		i1 = i, j1 = j;
+		while (i1 > front && adel[i1 - 1])
+			--i1;
+		while (j1 > front && bins[j1 - 1])
+			--j1;
+		debugPrint(4, "rerender hunk %d,%d becomes %d,%d",
+			   i1 + 1, i, j1 + 1, j);
+		if (wasdot > i1 && wasdot <= i) {
+			if (i - i1 == j - j1)
+				dotfall = wasdot - i1 + j1;
+			else
+				dotfall = (j > j1 ? j1 + 1 : j1);
+		}
+		if (i > i1)
+			delText(i1 + 1, i);
+		if (j > j1)
+			addTextToBuffer((pst) b[j1].s,
+					b[j - 1].s + b[j - 1].len - b[j1].s,
+					i1, false);
+		i = i1, j = j1;
+	}
+
+	nzFree(adel);
+	nzFree(bins);
+	nzFree(a);
+	nzFree(b);
+	return dotfall;
 }
 
 // Believe it or not, I have exercised all the pathways in this routine.
@@ -3475,13 +3911,44 @@ static bool activeBelow(Tag *t)
 
 static int hovcount, invcount, injcount, rrcount;
 
+/*********************************************************************
+Reformat the rendered text for rerender.
+The render has to run every time, because text and styles live in js
+and change without telling us, but most of the time the rendered string
+comes out the same as last time, and the buffer still holds what we made of it.
+Then there is nothing to do, and no need for htmlReformat,
+which is several passes over the page.
+We only keep a hash of each, not copies of the page.
+a is consumed. Returns null if the buffer is already current.
+*********************************************************************/
+
+static char *rrReformat(char *a, const char *snap, int snaplen)
+{
+	char *newbuf;
+	unsigned long long h = hashBytes(a, strlen(a));
+	if (h == cw->rrhash &&
+	    cw->rrll == formatLineLength && cw->rrov == formatOverflow &&
+	    hashBytes(snap, snaplen) == cw->rrfhash) {
+		debugPrint(4, "render unchanged, reformat skipped");
+		nzFree(a);
+		return 0;
+	}
+	newbuf = htmlReformat(a);
+	nzFree(a);
+	cw->rrhash = h;
+	cw->rrfhash = hashBytes(newbuf, strlen(newbuf));
+	cw->rrll = formatLineLength;
+	cw->rrov = formatOverflow;
+	return newbuf;
+}
+
 /* Rerender the buffer and notify of any lines that have changed */
 int rr_interval = 20;
 void rerender(int rr_command)
 {
 	char *a, *snap, *newbuf;
 	int j;
-	int markdot, wasdot, addtop;
+	int markdot, wasdot, dotfall;
 	bool z;
 	void (*say_fn) (int, ...);
 
@@ -3517,8 +3984,7 @@ void rerender(int rr_command)
 
 /* and the new screen */
 	a = render();
-	newbuf = htmlReformat(a);
-	nzFree(a);
+	newbuf = rrReformat(a, snap, j);
 	debugPrint(4, "%d nodes rendered", rrcount);
 
 	if (rr_command > 0 && debugLevel >= 3) {
@@ -3544,7 +4010,7 @@ void rerender(int rr_command)
 
 // the high runner case, most of the time nothing changes,
 // and we can check that efficiently with strcmp
-	if (stringEqual(newbuf, snap)) {
+	if (!newbuf || stringEqual(newbuf, snap)) {
 		if (rr_command > 0)
 			i_puts(MSG_NoChange);
 		nzFree(newbuf);
@@ -3554,22 +4020,14 @@ void rerender(int rr_command)
 
 /* mark dot, so it stays in place */
 	cw->labels[MARKDOT] = wasdot = cw->dot;
-	frontBackDiff(snap, newbuf);
-	addtop = 0;
-	if (sameBack1 > sameFront)
-		delText(sameFront + 1, sameBack1);
-	if (sameBack2 > sameFront) {
-		addTextToBuffer((pst) newChunkStart,
-				newChunkEnd - newChunkStart, sameFront, false);
-		addtop = sameFront + 1;
-	}
+	dotfall = patchLines(snap, newbuf, wasdot);
 	markdot = cw->labels[MARKDOT];
 	if (markdot)
 		cw->dot = markdot;
-	else if (sameBack1 == sameBack2)
-		cw->dot = wasdot;
-	else if (addtop)
-		cw->dot = addtop;
+	else if (dotfall)
+		cw->dot = dotfall;
+	if (cw->dot > cw->dol)
+		cw->dot = cw->dol;
 	cw->undoable = false;
 
 /*********************************************************************
@@ -3941,6 +4399,8 @@ bool timerWait(int *delay_sec, int *delay_ms)
 	struct jsTimer *jt;
 	time_t now;
 	int remaining = 0;
+// imap connections in IDLE want polling every so often
+	int idle = imapIdleDelay();
 
 	if (allowJS && cw->mustrender) {
 		time(&now);
@@ -3949,10 +4409,15 @@ bool timerWait(int *delay_sec, int *delay_ms)
 	}
 
 	if (!(jt = soonest())) {
-		if (!allowJS || !cw->mustrender)
-			return false;
+		if (!allowJS || !cw->mustrender) {
+			if (!idle)
+				return false;
+			remaining = idle;
+		}
 		*delay_sec = remaining;
 		*delay_ms = 0;
+		if (idle && *delay_sec > idle)
+			*delay_sec = idle;
 		return true;
 	}
 
@@ -3970,6 +4435,10 @@ bool timerWait(int *delay_sec, int *delay_ms)
 		*delay_sec = remaining;
 		*delay_ms = 0;
 	}
+	if (idle && *delay_sec >= idle) {
+		*delay_sec = idle;
+		*delay_ms = 0;
+	}
 
 	return true;
 }
@@ -5204,9 +5673,11 @@ past_cell_paragraph:
 						i_message(MSG_Push));
 		} else {
 // in case js checked or unchecked
-			if (allowJS && t->jslink)
+			if (allowJS && t->jslink) {
 				t->checked =
 				    get_property_bool_t(t, "checked");
+				t->jschecked = false;
+			}
 			stringAndChar(&ns, &ns_l, (t->checked ? '+' : '-'));
 		}
 		if (currentForm && (itype == INP_SUBMIT || itype == INP_IMAGE)) {
@@ -5527,6 +5998,64 @@ unparen:
 #undef checkDisabled
 }
 
+/*********************************************************************
+Write the rendered text to the file named by $EB_RFDUMP, for reformcheck.
+Each render replaces the file, so it holds the last page rendered.
+First a line for each tag that appears in the text:
+tag number, name, and para from its tagInfo,
+then the table type after a td, or a / after the closing pre.
+Then the word text on a line by itself, and the text,
+with \2 \3 \4 \r \f and \\ written out as escapes.
+*********************************************************************/
+
+static void renderDump(const char *buf)
+{
+	const char *file = getenv("EB_RFDUMP");
+	const char *s;
+	char *u, *seen;
+	FILE *f;
+	int n;
+
+	if (!file || !*file)
+		return;
+	if (!(f = fopen(file, "w"))) {
+		debugPrint(1, "cannot write %s", file);
+		return;
+	}
+	fprintf(f, "# %s\n", (cw->f0.fileName ? cw->f0.fileName : "?"));
+	seen = allocZeroMem(cw->numTags);
+	for (s = buf; (s = strchr(s, InternalCodeChar)); ) {
+		n = strtol(++s, &u, 10);
+		if (u > s && n < cw->numTags)
+			seen[n] = 1;
+	}
+	for (n = 0; n < cw->numTags; ++n) {
+		const Tag *t = tagList[n];
+		if (!seen[n])
+			continue;
+		fprintf(f, "tag %d %s %d", n, t->info->name, t->info->para);
+		if (t->action == TAGACT_TD)
+			fprintf(f, " %d", tableType(t));
+		if (t->action == TAGACT_PRE && t->slash)
+			fputs(" /", f);
+		putc('\n', f);
+	}
+	nzFree(seen);
+	fputs("text\n", f);
+	for (s = buf; *s; ++s) {
+		switch (*s) {
+		case InternalCodeChar: fputs("\\2", f); break;
+		case TableCellChar: fputs("\\3", f); break;
+		case DataCellChar: fputs("\\4", f); break;
+		case '\r': fputs("\\r", f); break;
+		case '\f': fputs("\\f", f); break;
+		case '\\': fputs("\\\\", f); break;
+		default: putc(*s, f);
+		}
+	}
+	fclose(f);
+}
+
 /* returns an allocated string */
 char *render(void)
 {
@@ -5542,10 +6071,10 @@ char *render(void)
 	currentForm = currentA = NULL;
 	if(cf != &cw->f0)
 		debugPrint(3, "render does not start at the top frame, context %d", cf->gsn);
-	traverse_callback = renderNode;
-	traverseAll();
+	traverseAll(renderNode);
 	if(cf != &cw->f0)
 		debugPrint(3, "render does not end at the top frame, context %d", cf->gsn);
+	renderDump(ns);
 	return ns;
 }
 
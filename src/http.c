@@ -322,6 +322,9 @@ static CURLcode fetch_internet(struct i_get *g)
 	return curlret;
 }
 
+static void preScanStart(struct i_get *g);
+static void preScan(const char *s, int len);
+
 /*********************************************************************
 Callback used by libcurl. Captures data from http, ftp, pop3, gopher.
 download states, in down_state:
@@ -398,6 +401,11 @@ eb_curl_callback(char *incoming, size_t size, size_t nitems, struct i_get * g)
 
 showdots:
 	dots1 = g->length / CHUNKSIZE;
+	if (g->down_state == 0 && g->foreground && g->csp) {
+		if (!g->length)
+			preScanStart(g);
+		preScan(incoming, num_bytes);
+	}
 	if (g->down_state == 0)
 		stringAndBytes(&g->buffer, &g->length, incoming, num_bytes);
 	else
@@ -1512,7 +1520,8 @@ void *httpConnectBack2(void *ptr)
 	g.down_force = 2;
 	g.tsn = ++tsn;
 	debugPrint(3, "jsbg thread %d", tsn);
-	rc = httpConnect(&g);
+	if (!preloadClaim(&g, &rc))
+		rc = httpConnect(&g);
 	nzFree(g.cfn);
 	nzFree(g.referrer);
 	t->loadsuccess = rc;
@@ -1581,6 +1590,314 @@ void *httpConnectBack3(void *ptr)
 	return NULL;
 }
 
+/*********************************************************************
+Preload scanner.
+The html scanner needs the whole page, and its charset, before it can
+build the tree, so it can't start until the download is done.
+But we can look ahead as the page streams in, spot <script src=...>,
+and start fetching those scripts in the background,
+the way a browser's preload scanner does.
+By the time prepareScript reaches the tag, the fetch is underway, or done,
+and preloadClaim hands it over.
+The scanner is a small resumable state machine, fed each block
+from eb_curl_callback. It knows about tags and comments, and not much else.
+A wrong guess costs a wasted fetch, nothing more.
+Stylesheets are not preloaded; they come in through xhr,
+which wants the response headers as well.
+Frames use the same machinery, see framePrefetch.
+*********************************************************************/
+
+struct preload {
+	struct preload *next, *prev;
+	char *url, *thisfile, *custom_h;
+	struct i_get g;
+	bool rc, done, orphan;
+	bool frame; // only good if it came back as an html page
+};
+
+static struct listHead preloads = { &preloads, &preloads };
+static pthread_mutex_t preloadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t preloadCond = PTHREAD_COND_INITIALIZER;
+
+#define MAXPRELOAD 32
+#define PRESCANTAG 1024
+static struct {
+	bool active;
+	uchar state; // 0 text, 1 in a tag, 2 in a comment, 3 tag too long
+	uchar dashes; // how much of --> we have seen
+	int tag_l, count;
+	char *base, *thisfile;
+	char tag[PRESCANTAG];
+} prescan;
+
+static void preloadFree(struct preload *p)
+{
+	nzFree(p->g.buffer);
+	nzFree(p->g.cfn);
+	nzFree(p->g.referrer);
+	nzFree(p->url);
+	nzFree(p->thisfile);
+	nzFree(p->custom_h);
+	free(p);
+}
+
+static void *preloadThread(void *ptr)
+{
+	struct preload *p = ptr;
+	bool rc = httpConnect(&p->g);
+	pthread_mutex_lock(&preloadLock);
+	p->rc = rc;
+	p->done = true;
+	if (p->orphan)
+		preloadFree(p);
+	pthread_cond_broadcast(&preloadCond);
+	pthread_mutex_unlock(&preloadLock);
+	return NULL;
+}
+
+static void preloadStart(const char *url, const char *thisfile,
+			 const char *custom_h, bool frame)
+{
+	struct preload *p;
+	pthread_t tid;
+	pthread_mutex_lock(&preloadLock);
+	foreach(p, preloads)
+		if (stringEqual(p->url, url)) {
+		pthread_mutex_unlock(&preloadLock);
+		return;
+	}
+	pthread_mutex_unlock(&preloadLock);
+	p = allocZeroMem(sizeof(struct preload));
+	p->url = cloneString(url);
+	p->thisfile = cloneString(thisfile);
+	p->custom_h = cloneString(custom_h);
+	p->frame = frame;
+	p->g.url = p->url;
+	p->g.thisfile = p->thisfile;
+	p->g.custom_h = p->custom_h;
+	p->g.uriEncoded = true;
+	p->g.down_force = 2;
+	p->g.tsn = ++tsn;
+	pthread_mutex_lock(&preloadLock);
+	addToListBack(&preloads, p);
+	if (pthread_create(&tid, NULL, preloadThread, p)) {
+		delFromList(p);
+		pthread_mutex_unlock(&preloadLock);
+		preloadFree(p);
+		return;
+	}
+	pthread_detach(tid);
+	pthread_mutex_unlock(&preloadLock);
+	debugPrint(3, "preload thread %d %s", p->g.tsn, url);
+}
+
+/*********************************************************************
+Let go of the preloads that were never claimed.
+Scripts are dropped when the next page comes in, they belonged to the last one.
+Frames are dropped when frameExpand is done with its range;
+one frame fetching its page in the foreground must not take
+the prefetches of its sibling frames with it.
+*********************************************************************/
+
+static void preloadDrain(bool frames)
+{
+	struct preload *p, *q;
+	pthread_mutex_lock(&preloadLock);
+	for (p = preloads.next; p != (void *)&preloads; p = q) {
+		q = p->next;
+		if (p->frame != frames)
+			continue;
+		delFromList(p);
+		if (p->done)
+			preloadFree(p);
+		else
+			p->orphan = true;
+	}
+	pthread_mutex_unlock(&preloadLock);
+}
+
+/*********************************************************************
+If g->url was preloaded, wait for that fetch to finish,
+and pass its results into g, as though httpConnect had run.
+Return false if there is no such preload,
+whence the caller should fetch it the usual way.
+A frame that came back as anything other than an html page
+is thrown away and fetched again in the foreground,
+where plugins, downloads, and passwords are handled.
+*********************************************************************/
+
+bool preloadClaim(struct i_get *g, bool *rc)
+{
+	struct preload *p;
+	bool found = false;
+	pthread_mutex_lock(&preloadLock);
+	foreach(p, preloads)
+		if (stringEqual(p->url, g->url)) {
+		found = true;
+		break;
+	}
+	if (!found) {
+		pthread_mutex_unlock(&preloadLock);
+		return false;
+	}
+	delFromList(p);
+	while (!p->done)
+		pthread_cond_wait(&preloadCond, &preloadLock);
+	pthread_mutex_unlock(&preloadLock);
+	if (p->frame && !(p->rc && p->g.code == 200 && p->g.csp)) {
+		debugPrint(3, "preloaded frame %s not used", g->url);
+		preloadFree(p);
+		return false;
+	}
+	debugPrint(3, "preloaded %s", g->url);
+	*rc = p->rc;
+	g->buffer = p->g.buffer, p->g.buffer = 0;
+	g->length = p->g.length;
+	g->code = p->g.code;
+	g->cfn = p->g.cfn, p->g.cfn = 0;
+	g->csp = p->g.csp;
+	strcpy(g->content, p->g.content);
+	preloadFree(p);
+	return true;
+}
+
+// Return the value of an attribute in a tag, allocated, or 0 if not present.
+static char *prescanAttr(const char *s, const char *name)
+{
+	const char *a, *v;
+	int l = strlen(name), n;
+	char q;
+// skip past the tag name
+	while (*s && !isspaceByte(*s) && *s != '/')
+		++s;
+	while (*s) {
+		while (isspaceByte(*s) || *s == '/')
+			++s;
+		if (!*s)
+			break;
+		a = s;
+		while (*s && *s != '=' && !isspaceByte(*s) && *s != '/')
+			++s;
+		n = s - a;
+		if (*s != '=') {
+			if (n == l && memEqualCI(a, name, l))
+				return cloneString(emptyString);
+			continue;
+		}
+		v = ++s;
+		if (*s == '"' || *s == '\'') {
+			q = *s, v = ++s;
+			while (*s && *s != q)
+				++s;
+		} else {
+			while (*s && !isspaceByte(*s))
+				++s;
+		}
+		if (n == l && memEqualCI(a, name, l))
+			return pullString(v, s - v);
+		if (*s)
+			++s;
+	}
+	return 0;
+}
+
+// A tag is complete, without its angle brackets; is it something to fetch?
+static void prescanTag(const char *s)
+{
+	char *src, *type, *url;
+	if (memEqualCI(s, "base", 4) && (isspaceByte(s[4]) || s[4] == '/')) {
+		if ((src = prescanAttr(s, "href")) && *src) {
+			url = resolveURL(prescan.base, src);
+			nzFree(prescan.base);
+			prescan.base = url;
+		}
+		nzFree(src);
+		return;
+	}
+	if (!memEqualCI(s, "script", 6) || !(isspaceByte(s[6]) || s[6] == '/'))
+		return;
+	if (!(src = prescanAttr(s, "src")))
+		return;
+	type = prescanAttr(s, "type");
+	if (*src && !isDataURI(src) && (!type || !*type
+	|| strcasestr(type, "javascript") || strcasestr(type, "ecmascript"))) {
+		url = resolveURL(prescan.base, src);
+		if (javaOK(url) && !fetchReplace(url)) {
+			preloadStart(url, prescan.thisfile, 0, false);
+			++prescan.count;
+		}
+		nzFree(url);
+	}
+	nzFree(type);
+	nzFree(src);
+}
+
+static void preScanStart(struct i_get *g)
+{
+	long code = 0;
+	char *url = 0;
+	nzFree(prescan.base);
+	nzFree(prescan.thisfile);
+	memset(&prescan, 0, sizeof(prescan));
+	preloadDrain(false);
+	if (!allowJS || !down_jsbg || !g->urlcopy || !javaOK(g->urlcopy))
+		return;
+	curl_easy_getinfo(g->h, CURLINFO_RESPONSE_CODE, &code);
+	if (code != 200)
+		return;
+// curl may have followed a redirect
+	curl_easy_getinfo(g->h, CURLINFO_EFFECTIVE_URL, &url);
+	if (!url)
+		url = g->urlcopy;
+	prescan.base = cloneString(url);
+	prescan.thisfile = cloneString(url);
+	prescan.active = true;
+}
+
+static void preScan(const char *s, int len)
+{
+	char c;
+	int i;
+	if (!prescan.active)
+		return;
+	for (i = 0; i < len && prescan.count < MAXPRELOAD; ++i) {
+		c = s[i];
+		switch (prescan.state) {
+		case 0:
+			if (c == '<')
+				prescan.state = 1, prescan.tag_l = 0;
+			break;
+		case 1:
+			if (c == '>') {
+				prescan.tag[prescan.tag_l] = 0;
+				prescanTag(prescan.tag);
+				prescan.state = 0;
+				break;
+			}
+			prescan.tag[prescan.tag_l++] = c;
+			if (prescan.tag_l == 3 && !memcmp(prescan.tag, "!--", 3)) {
+				prescan.state = 2, prescan.dashes = 0;
+				break;
+			}
+			if (prescan.tag_l == PRESCANTAG - 1)
+				prescan.state = 3;
+			break;
+		case 2:
+			if (c == '-')
+				++prescan.dashes;
+			else if (c == '>' && prescan.dashes >= 2)
+				prescan.state = 0;
+			else
+				prescan.dashes = 0;
+			break;
+		case 3:
+			if (c == '>')
+				prescan.state = 0;
+			break;
+		}
+	}
+}
+
 // copy text over to the buffer but change < to &lt; etc,
 // since this data will be browsed as if it were html.
 static void prepHtmlString(struct i_get *g, const char *q)
@@ -2778,18 +3095,25 @@ ebcurl_debug_handler(CURL * handle, curl_infotype info_desc, char *data,
 
 
 // There's a special case where this function is used
-// by the imap client to see if the server is move capable.
+// by the imap client to see if the server is move capable,
+// whether it supports condstore, for the envelope cache,
+// and whether it can expunge by uid.
 // Unfortunately this check runns all the while we are at db4, even for http etc,
 // but how often are we at db4?
 	if (info_desc == CURLINFO_HEADER_IN &&
 	    size > 17 && !strncmp(data, "* CAPABILITY IMAP", 17)) {
 		char *s;
 // data may not be null terminated; can't use strstr
-		for (s = data; s < data + size - 6; ++s)
-			if (!strncmp(s, " MOVE", 5) && isspaceByte(s[5])) {
+		for (s = data; s < data + size - 6; ++s) {
+			if (!strncmp(s, " MOVE", 5) && isspaceByte(s[5]))
 				g->move_capable = true;
-				break;
-			}
+			if (s < data + size - 11 &&
+			    !strncmp(s, " CONDSTORE", 10) && isspaceByte(s[10]))
+				g->condstore_capable = true;
+			if (s < data + size - 9 &&
+			    !strncmp(s, " UIDPLUS", 8) && isspaceByte(s[8]))
+				g->uidplus_capable = true;
+		}
 	}
 	if (debugLevel < 4)
 		return 0;
@@ -3029,6 +3353,11 @@ static bool crossOrigin(Tag *t, const char *url2)
 	const char *host1, *host2;
 	const char *prot2;
 
+// The src may have changed since the last check, so start over;
+// an old origin header must not go along to the new url.
+	nzFree(t->custom_h);
+	t->custom_h = 0;
+
 // If the bottom url is empty then it is a blank frame, which is fine,
 // or it was some javascript code, which has been moved to another
 // variable, and that's fine.
@@ -3103,11 +3432,60 @@ static bool crossOrigin(Tag *t, const char *url2)
 
 static int frameContractLine(int ln);
 
+// Find the frame tag on a line, return 0, or problem 1 or 2 as below.
+static int frameLine(int ln, Tag **tp)
+{
+	pst line = fetchLine(ln, -1);
+	const char *s = stringInBufLine((char *)line, "Frame ");
+	int tagno;
+	if (!s)
+		return 1;
+	if ((s = charInBufLine(s, InternalCodeChar)) == NULL)
+		return 2;
+	tagno = strtol(s + 1, (char **)&s, 10);
+	if (tagno < 0 || tagno >= cw->numTags || *s != '{')
+		return 2;
+	*tp = tagList[tagno];
+	return 0;
+}
+
+/*********************************************************************
+Expanding a range of frames, a portal or an ad-laden page might have a dozen,
+is mostly waiting on the network, one frame after another.
+The parse, the tree, and the js that follows all touch global state,
+and must run one frame at a time, but the fetches need not.
+Start them all in the background, through the preload threads,
+and frameExpandLine claims each page when it gets there, in readFile.
+Only urls, and only when js downloads in the background are allowed;
+about:blank, javascript:, and local files are quick anyways.
+*********************************************************************/
+
+static void framePrefetch(int ln1, int ln2)
+{
+	int ln, n = 0;
+	Tag *t;
+	const char *s;
+	for (ln = ln1; ln <= ln2 && n < MAXPRELOAD; ++ln) {
+		if (frameLine(ln, &t))
+			continue;
+		if (t->action != TAGACT_FRAME || t->f1 || t->expf)
+			continue;
+		s = t->href;
+		if (!s || !isURL(s) || !crossOrigin(t, s))
+			continue;
+		preloadStart(s, cw->f0.fileName, t->custom_h, true);
+		++n;
+	}
+}
+
 bool frameExpand(bool expand, int ln1, int ln2)
 {
 	int ln;			/* line number */
 	int problem = 0, p;
-	bool something_worked = false;
+	bool something_worked = false, prefetch = false;
+
+	if (expand && ln2 > ln1 && down_jsbg)
+		framePrefetch(ln1, ln2), prefetch = true;
 
 	for (ln = ln1; ln <= ln2; ++ln) {
 		if (expand)
@@ -3119,6 +3497,8 @@ bool frameExpand(bool expand, int ln1, int ln2)
 		if (p == 0)
 			something_worked = true;
 	}
+	if (prefetch)
+		preloadDrain(true);
 
 	if (something_worked && problem < 3)
 		problem = 0;
@@ -3135,26 +3515,15 @@ bool frameExpand(bool expand, int ln1, int ln2)
  3 Problem fetching the rul or rendering the page.  */
 int frameExpandLine(int ln, Tag *t)
 {
-	pst line;
-	int tagno, start;
+	int p, pn, start;
 	const char *s, *jssrc = 0;
 	char *a;
 	Frame *save_cf, *last_f;
 	bool fromget = !ln;
 	Tag *cdt;	// contentDocument tag
 
-	if(!t) {
-		line = fetchLine(ln, -1);
-		s = stringInBufLine((char *)line, "Frame ");
-		if (!s)
-			return 1;
-		if ((s = charInBufLine(s, InternalCodeChar)) == NULL)
-			return 2;
-		tagno = strtol(s + 1, (char **)&s, 10);
-		if (tagno < 0 || tagno >= cw->numTags || *s != '{')
-			return 2;
-		t = tagList[tagno];
-	}
+	if(!t && (p = frameLine(ln, &t)))
+		return p;
 
 	if (t->action != TAGACT_FRAME)
 		return 1;
@@ -3216,10 +3585,13 @@ int frameExpandLine(int ln, Tag *t)
 	debugPrint(2, "fetch frame %s",
 		   (s ? s : (jssrc ? "javascript" : "empty")));
 
+	pn = profBegin("frame");
 	if (s) {
 		bool rc = false;
+		int fn = profBegin("fetch");
 		if(crossOrigin(t, s))
 			rc = readFileArgv(s, (fromget ? 2 : 1), t->custom_h);
+		profEnd(fn, s);
 		if (!rc) {
 /* serverData was never set, or was freed do to some other error. */
 /* We just need to pop the frame and return. */
@@ -3228,6 +3600,7 @@ int frameExpandLine(int ln, Tag *t)
 			free(cf);
 			last_f->next = 0;
 			cf = save_cf;
+			profEnd(pn, s);
 			return 0;
 		}
 
@@ -3245,6 +3618,7 @@ So check for serverData null here. Once again we pop the frame.
 			last_f->next = 0;
 			cf = save_cf;
 			fileSize = -1;
+			profEnd(pn, s);
 			return 0;
 		}
 	} else {
@@ -3271,20 +3645,28 @@ So check for serverData null here. Once again we pop the frame.
 
 	cf->hbase = cloneString(cf->fileName);
 	prepareForBrowse(serverData, serverDataLen);
-	if (javaOK(cf->fileName))
+	if (javaOK(cf->fileName)) {
+		p = profBegin("js context");
 		createJSContext(cf);
+		profEnd(p, 0);
+	}
 	nzFree(newlocation), newlocation = 0;
 
 	start = cw->numTags;
 	cdt = newTag(cf, "Document");
 	cdt->parent = t, t->firstchild = cdt;
-	cdt->attributes = allocZeroMem(sizeof(char*));
-	cdt->atvals = allocZeroMem(sizeof(char*));
+// empty attribute arrays, one block, as in setTagAttr
+	cdt->attributes = allocZeroMem(2 * sizeof(char*));
+	cdt->atvals = cdt->attributes + 1;
 	debugPrint(3, "parse html from frame");
+	p = profBegin("scan");
 	htmlScanner(serverData, cdt, false);
+	profEnd(p, 0);
 	nzFree(serverData);	/* don't need it any more */
 	serverData = 0;
+	p = profBegin("prerender");
 	prerender();
+	profEnd(p, 0);
 
 /*********************************************************************
 At this point cdt->step is 1; the html tree is built, but not decorated.
@@ -3293,12 +3675,16 @@ cdt doesn't have or need an object; it's a place holder.
 	cdt->step = 2;
 
 	if (cf->jslink) {
+		p = profBegin("decorate");
 		decorate();
+		profEnd(p, 0);
 		set_basehref(cf->hbase);
 		run_function_bool_win(cf, "eb$qs$start");
 		if (jssrc)
 			jsRunScriptWin(jssrc, "frame.src", 1);
+		p = profBegin("scripts");
 		runScriptsPending(true);
+		profEnd(p, 0);
 		runOnload();
 		runScriptsPending(false);
 		run_function_bool_win(cf, "readyStateComplete");
@@ -3328,6 +3714,7 @@ cdt doesn't have or need an object; it's a place holder.
 
 // success, frame is expanded
 	cf = save_cf;
+	profEnd(pn, t->href);
 	return 0;
 }
 
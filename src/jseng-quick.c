@@ -11,6 +11,7 @@ you will need to include the MIT open source license.
 
 #include <stddef.h>
 #include <sys/utsname.h>
+#include <sys/time.h>
 
 // the makefile should set -I properly, based on  your environment variable
 // QUICKJS_DIR, or using a reasonable default.
@@ -146,6 +147,46 @@ static JSRuntime *jsrt;
 static bool js_running;
 static JSContext *mwc; // master window context
 
+/*********************************************************************
+Property names that the bridge reads and writes over and over:
+every option of every select in rebuildSelectors, every field value pushed from jSyncup,
+every trip through soj$ for css, every read of input.value.
+JS_GetPropertyStr hashes the name into an atom each time, and frees it after.
+Atoms belong to the runtime, not to a context, so these are made once,
+in js_main, and are good in every frame.
+*********************************************************************/
+
+enum {
+	PA_value, PA_val_ue, PA_text, PA_selected,
+	PA_defaultSelected, PA_options, PA_length, PA_selectedIndex,
+	PA_soj, PA_innerHTML, PA_inner_HTML, PA_dom_class,
+	PA_style2, PA_href, PA_src, PA_action,
+	PA_LAST
+};
+
+static const char *const pa_names[PA_LAST] = {
+	"value", "val$ue", "text", "selected",
+	"defaultSelected", "options", "length", "selectedIndex",
+	"soj$", "innerHTML", "inner$HTML", "dom$class",
+	"style$2", "href", "src", "action",
+};
+
+static JSAtom pa[PA_LAST];
+
+static void makeAtoms(void)
+{
+	int i;
+	for (i = 0; i < PA_LAST; ++i)
+		pa[i] = JS_NewAtom(mwc, pa_names[i]);
+}
+
+static void freeAtoms(void)
+{
+	int i;
+	for (i = 0; i < PA_LAST; ++i)
+		JS_FreeAtom(mwc, pa[i]);
+}
+
 // Find window and frame based on the js context. Set cw and cf accordingly.
 // This is inefficient, but is not called very often.
 static bool frameFromContext(jsobjtype cx)
@@ -211,15 +252,25 @@ static enum ej_proptype top_proptype(JSContext *cx, JSValueConst v)
 	return EJ_PROP_NONE;	// don't know
 }
 
-static enum ej_proptype typeof_property(JSContext *cx, JSValueConst parent, const char *name)
+// Each level 0 getter has an atom form, ending in _a, for the names in pa[],
+// and the usual form that takes the name as a string.
+static enum ej_proptype typeof_property_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	enum ej_proptype l = top_proptype(cx, v);
 	grab(v);
 	JS_Release(cx, v);
 	return l;
 }
 
+static enum ej_proptype typeof_property(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	enum ej_proptype l = typeof_property_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return l;
+}
+
 enum ej_proptype typeof_property_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -229,9 +280,9 @@ return typeof_property(t->f0->cx, *((JSValue*)t->jv), name);
 
 /* Return a property as a string, if it is
  * string compatible. The string is allocated, free it when done. */
-static char *get_property_string(JSContext *cx, JSValueConst parent, const char *name)
+static char *get_property_string_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	const char *s;
 	char *s0 = NULL;
 	enum ej_proptype proptype = top_proptype(cx, v);
@@ -247,6 +298,14 @@ static char *get_property_string(JSContext *cx, JSValueConst parent, const char
 	return s0;
 }
 
+static char *get_property_string(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	char *s0 = get_property_string_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return s0;
+}
+
 char *get_property_string_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -254,9 +313,9 @@ return 0;
 return get_property_string(t->f0->cx, *((JSValue*)t->jv), name);
 }
 
-static bool get_property_bool(JSContext *cx, JSValue parent, const char *name)
+static bool get_property_bool_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	bool b = false;
 	grab(v);
 	if(JS_IsBool(v))
@@ -271,6 +330,14 @@ static bool get_property_bool(JSContext *cx, JSValue parent, const char *name)
 	return b;
 }
 
+static bool get_property_bool(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	bool b = get_property_bool_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return b;
+}
+
 bool get_property_bool_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -278,9 +345,9 @@ return false;
 return get_property_bool(t->f0->cx, *((JSValue*)t->jv), name);
 }
 
-static int get_property_number(JSContext *cx, JSValueConst parent, const char *name)
+static int get_property_number_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	int32_t n = -1;
 	grab(v);
 	if(JS_IsNumber(v))
@@ -290,6 +357,14 @@ static int get_property_number(JSContext *cx, JSValueConst parent, const char *n
 	return n;
 }
 
+static int get_property_number(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	int n = get_property_number_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return n;
+}
+
 int get_property_number_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -301,9 +376,9 @@ return get_property_number(t->f0->cx, *((JSValue*)t->jv), name);
 // should this return 0 for null, which is tehcnically an object?
 // How bout function or array?
 // The object returned is a duplicate and must be freed.
-static JSValue get_property_object(JSContext *cx, JSValueConst parent, const char *name)
+static JSValue get_property_object_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	grab(v);
 	if(JS_IsObject(v))
 		return v;
@@ -311,12 +386,20 @@ static JSValue get_property_object(JSContext *cx, JSValueConst parent, const cha
 	return JS_UNDEFINED;
 }
 
+static JSValue get_property_object(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	JSValue v = get_property_object_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return v;
+}
+
 // return -1 for error
 static int get_arraylength(JSContext *cx, JSValueConst a)
 {
 	if(!JS_IsArray(cx, a))
 		return -1;
-	return get_property_number(cx, a, "length");
+	return get_property_number_a(cx, a, pa[PA_length]);
 }
 
 // quick seems to have no direct way to access a.length or a[i],
@@ -340,33 +423,33 @@ static char *get_property_url(JSContext *cx, JSValueConst owner, bool action)
 	JSValue uo = JS_UNDEFINED;	/* url object */
 	char *s;
 	if (action) {
-		mtype = typeof_property(cx, owner, "action");
+		mtype = typeof_property_a(cx, owner, pa[PA_action]);
 		if (mtype == EJ_PROP_STRING)
-			return get_property_string(cx, owner, "action");
+			return get_property_string_a(cx, owner, pa[PA_action]);
 		if (mtype != EJ_PROP_OBJECT)
 			return 0;
-		uo = get_property_object(cx, owner, "action");
+		uo = get_property_object_a(cx, owner, pa[PA_action]);
 	} else {
-		mtype = typeof_property(cx, owner, "href");
+		mtype = typeof_property_a(cx, owner, pa[PA_href]);
 		if (mtype == EJ_PROP_STRING)
-			return get_property_string(cx, owner, "href");
+			return get_property_string_a(cx, owner, pa[PA_href]);
 		if (mtype == EJ_PROP_OBJECT)
-			uo = get_property_object(cx, owner, "href");
+			uo = get_property_object_a(cx, owner, pa[PA_href]);
 		else if (mtype)
 			return 0;
 		if (JS_IsUndefined(uo)) {
-			mtype = typeof_property(cx, owner, "src");
+			mtype = typeof_property_a(cx, owner, pa[PA_src]);
 			if (mtype == EJ_PROP_STRING)
-				return get_property_string(cx, owner, "src");
+				return get_property_string_a(cx, owner, pa[PA_src]);
 			if (mtype == EJ_PROP_OBJECT)
-				uo = get_property_object(cx, owner, "src");
+				uo = get_property_object_a(cx, owner, pa[PA_src]);
 		}
 	}
 	if (JS_IsUndefined(uo))
 		return 0;
 // Don't use href$val, that's our baby, and lots of websites overload the URL
 // class with their own, which doesn't have the internal workings of ours.
-	s = get_property_string(cx, uo, "href");
+	s = get_property_string_a(cx, uo, pa[PA_href]);
 	JS_Release(cx, uo);
 	return s;
 }
@@ -385,7 +468,7 @@ char *get_style_string_t(const Tag *t, const char *name)
 	char *result;
 	if(!t->jslink || !allowJS)
 		return 0;
-	so = get_property_object(cx, *((JSValue*)t->jv), "style$2");
+	so = get_property_object_a(cx, *((JSValue*)t->jv), pa[PA_style2]);
 	if(JS_IsUndefined(so))
 		return 0;
 	result = get_property_string(cx, so, name);
@@ -397,7 +480,7 @@ char *get_style_string_t(const Tag *t, const char *name)
 
 static JSValue getter_innerHTML(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
 {
-	return JS_GetPropertyStr(cx, this, "inner$HTML");
+	return JS_GetProperty(cx, this, pa[PA_inner_HTML]);
 }
 
 static JSValue setter_innerHTML(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
@@ -429,7 +512,7 @@ static JSValue setter_innerHTML(JSContext * cx, JSValueConst this, int argc, JSV
 	const char *h1 = h;
 // secret code for xml
 	if(!strncmp(h1, "`~*xml}@;", 9)) h1 += 9;
-	JS_SetPropertyStr(cx, this, "inner$HTML", JS_NewAtomString(cx, h1));
+	JS_SetProperty(cx, this, pa[PA_inner_HTML], JS_NewAtomString(cx, h1));
 
 // Put some tags around the html, so we can parse it.
 	run = initString(&run_l);
@@ -473,7 +556,7 @@ static JSValue setter_innerHTML(JSContext * cx, JSValueConst this, int argc, JSV
 
 static JSValue getter_value(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
 {
-	return JS_GetPropertyStr(cx, this, "val$ue");
+	return JS_GetProperty(cx, this, pa[PA_val_ue]);
 }
 
 static JSValue setter_value(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
@@ -484,7 +567,7 @@ static JSValue setter_value(JSContext * cx, JSValueConst this, int argc, JSValue
 	if (!h)			// should never happen
 		return JS_UNDEFINED;
 	debugPrint(5, "setter v in");
-	JS_SetPropertyStr(cx, this, "val$ue", JS_NewAtomString(cx, h));
+	JS_SetProperty(cx, this, pa[PA_val_ue], JS_NewAtomString(cx, h));
 	k = cloneString(h);
 	prepareForField(k);
 	JS_FreeCString(cx, h);
@@ -498,46 +581,51 @@ static JSValue setter_value(JSContext * cx, JSValueConst this, int argc, JSValue
 	return JS_UNDEFINED;
 }
 
-static void set_property_string(JSContext *cx, JSValueConst parent, const char *name,
+static void set_property_string_a(JSContext *cx, JSValueConst parent, JSAtom a,
 			    const char *value)
 {
 	bool defset = false;
 	JSCFunction *getter = 0;
 	JSCFunction *setter = 0;
-	const char *altname;
-	if (stringEqual(name, "innerHTML"))
+	JSAtom altname;
+	if (a == pa[PA_innerHTML])
 		getter = getter_innerHTML,
 		setter = setter_innerHTML,
-		    altname = "inner$HTML";
-	if (stringEqual(name, "value")) {
+		    altname = pa[PA_inner_HTML];
+	if (a == pa[PA_value]) {
 // Only meaningful in the Element class
-		JSValue dc = JS_GetPropertyStr(cx, parent, "dom$class");
+		JSValue dc = JS_GetProperty(cx, parent, pa[PA_dom_class]);
 		const char *dcs = JS_ToCString(cx, dc);
 		grab(dc);
 		if(stringEqual(dcs, "HTMLInputElement") ||
 		stringEqual(dcs, "HTMLTextAreaElement"))
 			getter = getter_value,
 			setter = setter_value,
-			    altname = "val$ue";
+			    altname = pa[PA_val_ue];
 		JS_FreeCString(cx, dcs);
 		JS_Release(cx, dc);
 	}
 	if (setter) {
 // see if we already did this - does the property show up as a string?
-		if(typeof_property(cx, parent, name) != EJ_PROP_STRING)
+		if(typeof_property_a(cx, parent, a) != EJ_PROP_STRING)
 			defset = true;
 	}
-	if (defset) {
-		JSAtom a = JS_NewAtom(cx, name);
+	if (defset)
 		JS_DefinePropertyGetSet(cx, parent, a,
 		JS_NewCFunction(cx, getter, "get", 0),
 		JS_NewCFunction(cx, setter, "set", 0),
 		JS_PROP_ENUMERABLE);
-		JS_FreeAtom(cx, a);
-	}
 	if (!value)
 		value = emptyString;
-	JS_SetPropertyStr(cx, parent, (setter ? altname : name), JS_NewAtomString(cx, value));
+	JS_SetProperty(cx, parent, (setter ? altname : a), JS_NewAtomString(cx, value));
+}
+
+static void set_property_string(JSContext *cx, JSValueConst parent, const char *name,
+			    const char *value)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	set_property_string_a(cx, parent, a, value);
+	JS_FreeAtom(cx, a);
 }
 
 void set_property_string_t(const Tag *t, const char *name, const char * v)
@@ -587,6 +675,11 @@ void set_property_object_doc(const Frame *f, const char *name, const Tag *t2)
 	set_property_object(f->cx, *((JSValue*)f->docobj), name, *((JSValue*)t2->jv));
 }
 
+static void set_property_number_a(JSContext *cx, JSValueConst parent, JSAtom a, int n)
+{
+	JS_SetProperty(cx, parent, a, JS_NewInt32(cx, n));
+}
+
 static void set_property_number(JSContext *cx, JSValueConst parent, const char *name, int n)
 {
 	JS_SetPropertyStr(cx, parent, name, JS_NewInt32(cx, n));
@@ -1113,6 +1206,99 @@ static char *run_script(JSContext *cx, const char *s)
 	return result;
 }
 
+/*********************************************************************
+Keep the compiled bytecode of external scripts in the http cache,
+so the same library, run again on the next page or in the next session,
+need not be parsed and compiled again.
+The key is a hash of the script and its filename, the filename because
+it is built into the bytecode for error messages,
+and a fingerprint of the js engine, because bytecode written by one
+version of quick means nothing to another.
+The fingerprint is the hash of a tiny compiled function;
+if the bytecode format changes, so does the fingerprint.
+Small scripts aren't worth the trip to the cache.
+*********************************************************************/
+
+#define JSBC_MINSIZE 4096
+
+static unsigned long long engineFingerprint(JSContext *cx)
+{
+	static unsigned long long fp;
+	static const char probe[] = "(function(a,b){return [a+b,'x',{y:1}]})";
+	JSValue r;
+	uint8_t *b;
+	size_t l;
+	if (fp)
+		return fp;
+	r = JS_Eval(cx, probe, strlen(probe), "probe",
+	JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+	if (JS_IsException(r)) {
+// should never happen, clear the exception and don't cache anything
+		JS_FreeValue(cx, JS_GetException(cx));
+		return 0;
+	}
+	b = JS_WriteObject(cx, &l, r, JS_WRITE_OBJ_BYTECODE);
+	JS_FreeValue(cx, r);
+	if (!b)
+		return 0;
+	fp = hashBytes((char *)b, l) ^ hashBytes(version, strlen(version));
+	js_free(cx, b);
+	return fp;
+}
+
+static char *bytecodeKey(JSContext *cx, const char *s, int len, const char *filename)
+{
+	char *key;
+	unsigned long long fp, h;
+	if (!curlActive)
+		return 0;
+	if (len < JSBC_MINSIZE)
+		return 0;
+	if (!(fp = engineFingerprint(cx)))
+		return 0;
+	h = hashBytes(s, len) ^ hashBytes(filename, strlen(filename)) * 31;
+	ignore = asprintf(&key, "jsbc:%016llx%016llx", fp, h);
+	return key;
+}
+
+// Compile the script, or bring its bytecode from cache.
+// Returns the compiled function, or an exception.
+static JSValue compileScript(JSContext *cx, const Tag *t, const char *s, const char *filename)
+{
+	JSValue r;
+	char *key = 0, *data;
+	int data_l;
+	size_t l;
+	uint8_t *b;
+	int len = strlen(s);
+
+	if (t->href && !isDataURI(t->href))
+		key = bytecodeKey(cx, s, len, filename);
+	if (key && fetchCache(key, 0, 0, true, &data, &data_l)) {
+		r = JS_ReadObject(cx, (uint8_t *)data, data_l, JS_READ_OBJ_BYTECODE);
+		nzFree(data);
+		if (!JS_IsException(r)) {
+			debugPrint(3, "bytecode from cache %s", key);
+			free(key);
+			return r;
+		}
+// stale or corrupt, compile it again
+		JS_FreeValue(cx, JS_GetException(cx));
+	}
+
+	r = JS_Eval(cx, s, len, filename,
+	JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+	if (key && !JS_IsException(r)) {
+		b = JS_WriteObject(cx, &l, r, JS_WRITE_OBJ_BYTECODE);
+		if (b) {
+			storeCache(key, 0, 0, (char *)b, l);
+			js_free(cx, b);
+		}
+	}
+	nzFree(key);
+	return r;
+}
+
 // execute script.text code; more efficient than the above.
 void jsRunData(const Tag *t, const char *filename, int lineno)
 {
@@ -1147,8 +1333,9 @@ void jsRunData(const Tag *t, const char *filename, int lineno)
 		char *result = run_script(cx, s);
 		nzFree(result);
 	} else {
-		JSValue r = JS_Eval(cx, s, strlen(s),
-		(jsSourceFile ? jsSourceFile : "internal"), JS_EVAL_TYPE_GLOBAL);
+		JSValue r = compileScript(cx, t, s, (jsSourceFile ? jsSourceFile : "internal"));
+		if (!JS_IsException(r))
+			r = JS_EvalFunction(cx, r);
 		grab(r);
 		if (intFlag)
 			i_puts(MSG_Interrupted);
@@ -1726,6 +1913,49 @@ done:
 	return JS_UNDEFINED;
 }
 
+// js has checked or unchecked this box, or changed the options of this select.
+// Remember the tag, so jSyncup and rebuildSelectors need only look at
+// the fields that moved, not every field on the page.
+static void fieldChanged(Tag *t)
+{
+	Window *w = t->f0->owner;
+	if (t->action == TAGACT_INPUT && t->itype >= INP_RADIO) {
+		t->jschecked = true;
+		return;
+	}
+	if (t->action != TAGACT_DATAL &&
+	    (t->action != TAGACT_INPUT || t->itype != INP_SELECT))
+		return;
+	if (t->seldirty)
+		return;
+	t->seldirty = true;
+	t->dirtynext = w->seldirty;
+	w->seldirty = t;
+}
+
+static void objectChanged(JSContext *cx, JSValueConst v)
+{
+	Tag *t;
+	int n;
+	if (!JS_IsObject(v))
+		return;
+// eb$seqno takes us right to the tag, tagFromObject would walk the list
+	n = get_property_number(cx, v, "eb$seqno");
+	if (n < 0 || n >= cw->numTags)
+		return;
+	t = tagList[n];
+	if (t->jslink && !t->dead &&
+	    JS_VALUE_GET_OBJ(*((JSValue*)t->jv)) == JS_VALUE_GET_OBJ(v))
+		fieldChanged(t);
+}
+
+static JSValue nat_fieldchange(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
+{
+	if (argc >= 1)
+		objectChanged(cx, argv[0]);
+	return JS_UNDEFINED;
+}
+
 static JSValue nat_media(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
 {
 	const char *s = JS_ToCString(cx, argv[0]);
@@ -2068,8 +2298,16 @@ JSValueConst b_j, const char *b_name)
 	if (stringEqual(p_name, "option"))
 		return;
 
-	if (stringEqual(a_name, "option"))
+	if (stringEqual(a_name, "option")) {
+// but tell rebuildSelectors which select to look at
+		if (stringEqual(p_name, "optgroup")) {
+			JSValue g = get_property_object(cx, p_j, "parentNode");
+			objectChanged(cx, g);
+			JS_Release(cx, g);
+		} else
+			objectChanged(cx, p_j);
 		return;
+	}
 
 	parent = tagFromObject(p_j);
 // If parent node has been removed, we don't have to keep its linkage current.
@@ -2996,15 +3234,14 @@ static JSValue nat_setcook(JSContext * cx, JSValueConst this, int argc, JSValueC
 
 static JSValue nat_css_start(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
 {
-// The selection string has to be allocated - css will use it in place,
-// then free it later.
+// css copies each style sheet as it compiles it, or finds it in the cache.
 	int32_t n;
 	const char *s;
 	int b;
 	JS_ToInt32(cx, &n, argv[0]);
 	s = JS_ToCString(cx, argv[1]);
 	b = JS_ToBool(cx, argv[2]);
-	cssDocLoad(n, cloneString(s), b);
+	cssDocLoad(n, s, b);
 	JS_FreeCString(cx, s);
 	return JS_UNDEFINED;
 }
@@ -3459,6 +3696,7 @@ JSValue mwo; // master window object
 		JS_SetMaxStackSize(jsrt, 2048*1024);
 	mwc = JS_NewContext(jsrt);
 	mwo = JS_GetGlobalObject(mwc);
+	makeAtoms();
 
 /*********************************************************************
 Why put native functions in the master window, to be shared?
@@ -3646,6 +3884,8 @@ static void createJSContext_0(Frame *f)
 
     JS_DefinePropertyValueStr(cx, g, "eb$media",
 JS_NewCFunction(cx, nat_media, "media", 1), 0);
+    JS_DefinePropertyValueStr(cx, g, "eb$fieldchange",
+JS_NewCFunction(cx, nat_fieldchange, "fieldchange", 1), 0);
     JS_DefinePropertyValueStr(cx, g, "eb$unframe",
 JS_NewCFunction(cx, nat_unframe, "unframe", 1), 0);
     JS_DefinePropertyValueStr(cx, g, "eb$unframe2",
@@ -3720,6 +3960,7 @@ JS_NewCFunction(cx, nat_rmch2, "removeChild", 1), 0);
 static void setup_window_2(void);
 void createJSContext(Frame *f)
 {
+	struct timeval tv0, tv1;
 	if (!allowJS)
 		return;
 	js_main();
@@ -3727,15 +3968,70 @@ void createJSContext(Frame *f)
 		i_puts(MSG_JSEngineRun);
 		return;
 	}
+	gettimeofday(&tv0, NULL);
 	createJSContext_0(f);
 	if (f->cx) {
 		f->jslink = true;
 		setup_window_2();
+		gettimeofday(&tv1, NULL);
+		debugPrint(3, "js context %d ready in %ld ms", f->gsn,
+		(long)(tv1.tv_sec - tv0.tv_sec) * 1000 + (tv1.tv_usec - tv0.tv_usec) / 1000);
 	} else {
 		i_puts(MSG_JavaContextError);
 	}
 }
 
+/*********************************************************************
+startwindow.js runs in every frame and iframe, some 3,000 lines of js,
+and a page with a dozen iframes would parse and compile it a dozen times.
+Compile it once, save the bytecode with JS_WriteObject,
+and read it into each new context with JS_ReadObject, which is much faster.
+We can't share the compiled function itself across contexts,
+because quick binds compiled code to the realm that compiled it.
+If there are breakpoints or trace points in the source, run it as source,
+so that run_script can expand those macros.
+*********************************************************************/
+
+static uint8_t *swBytecode;
+static size_t swBytecode_l;
+
+static void runStartWindow(JSContext *cx)
+{
+	JSValue r;
+	uint8_t *b;
+
+	if (strstr(startWindowJS, "bp@(") || strstr(startWindowJS, "trace@(")) {
+		jsRunScriptWin(startWindowJS, "startwindow.js", 1);
+		return;
+	}
+
+	jsSourceFile = "startwindow.js";
+	jsLineno = 1;
+	if (swBytecode) {
+		r = JS_ReadObject(cx, swBytecode, swBytecode_l, JS_READ_OBJ_BYTECODE);
+	} else {
+		r = JS_Eval(cx, startWindowJS, strlen(startWindowJS),
+		jsSourceFile, JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+		if (!JS_IsException(r)) {
+			b = JS_WriteObject(cx, &swBytecode_l, r, JS_WRITE_OBJ_BYTECODE);
+			if (b) {
+// keep our own copy, quick allocated this one in its runtime
+				swBytecode = (uint8_t *)cloneMemory((char *)b, swBytecode_l);
+				js_free(cx, b);
+				debugPrint(3, "startwindow.js compiled, %zu bytes of bytecode", swBytecode_l);
+			}
+		}
+	}
+	if (!JS_IsException(r))
+		r = JS_EvalFunction(cx, r);
+	if (intFlag)
+		i_puts(MSG_Interrupted);
+	if (JS_IsException(r))
+		processError(cx);
+	JS_FreeValue(cx, r);
+	jsSourceFile = 0;
+}
+
 static void setup_window_2(void)
 {
 	JSContext *cx = cf->cx;	// current context
@@ -3755,7 +4051,7 @@ static void setup_window_2(void)
 /* the js window/document setup script.
  * These are all the things that do not depend on the platform,
  * OS, configurations, etc. */
-	jsRunScriptWin(startWindowJS, "startwindow.js", 1);
+	runStartWindow(cx);
 
 	d = JS_GetPropertyStr(cx, w, "document");
 	cf->docobj = allocMem(sizeof(JSValue));
@@ -4210,8 +4506,8 @@ I'm bringing the tags back to life.
 			connect_o = true;
 		}
 
-		t->rchecked = get_property_bool(cx, oo, "defaultSelected");
-		check2 = get_property_bool(cx, oo, "selected");
+		t->rchecked = get_property_bool_a(cx, oo, pa[PA_defaultSelected]);
+		check2 = get_property_bool_a(cx, oo, pa[PA_selected]);
 		if (check2) {
 			if (sel->multiple)
 				++sel->lic;
@@ -4222,14 +4518,14 @@ I'm bringing the tags back to life.
 		if (t->checked != check2)
 			changed = true;
 		t->checked = check2;
-		s = get_property_string(cx, oo, "text");
+		s = get_property_string_a(cx, oo, pa[PA_text]);
 		if ((s && !t->textval) || !stringEqual(t->textval, s)) {
 			nzFree(t->textval);
 			t->textval = s;
 			changed = true;
 		} else
 			nzFree(s);
-		s = get_property_string(cx, oo, "value");
+		s = get_property_string_a(cx, oo, pa[PA_value]);
 		if ((s && !t->value) || !stringEqual(t->value, s)) {
 			nzFree(t->value);
 			t->value = s;
@@ -4267,16 +4563,16 @@ I'm bringing the tags back to life.
 			t->controller = sel;
 			connectTagObject(t, oo);
 			t->step = 2;	// already decorated
-			t->textval = get_property_string(cx, oo, "text");
-			t->value = get_property_string(cx, oo, "value");
-			t->checked = get_property_bool(cx, oo, "selected");
+			t->textval = get_property_string_a(cx, oo, pa[PA_text]);
+			t->value = get_property_string_a(cx, oo, pa[PA_value]);
+			t->checked = get_property_bool_a(cx, oo, pa[PA_selected]);
 			if (t->checked) {
 				if (sel->multiple)
 					++sel->lic;
 				else
 					sel->lic = i2;
 			}
-			t->rchecked = get_property_bool(cx, oo, "defaultSelected");
+			t->rchecked = get_property_bool_a(cx, oo, pa[PA_defaultSelected]);
 			changed = true;
 		}
 	}
@@ -4292,49 +4588,55 @@ I'm bringing the tags back to life.
 	nzFree(s);
 
 	if (!sel->multiple)
-		set_property_number(cx, *((JSValue*)sel->jv), "selectedIndex", sel->lic);
+		set_property_number_a(cx, *((JSValue*)sel->jv), pa[PA_selectedIndex], sel->lic);
 // rebuild the live selectedOptions array
 	run_function_bool(cx, *((JSValue*)sel->jv), "eb$bso");
 }
 
+// This is called from many places, rerender, submit, reset, every command
+// after js has run. Rather than walk every select and every option in js,
+// look only at the selects that js has touched, those on cw->seldirty.
+// eb$bso, the option setters, and domSetsLinkage put them there.
 void rebuildSelectors(void)
 {
-	int i1;
 	Tag *t;
 	JSContext *cx;
 	JSValue oa;		/* option array */
 	int len;		/* length of option array */
 
-	for (i1 = 0; i1 < cw->numTags; ++i1) {
-		t = tagList[i1];
-		if (!t->jslink || (t->action != TAGACT_DATAL &&
-		(t->action != TAGACT_INPUT || t->itype != INP_SELECT)))
-			continue;
-
+	while ((t = cw->seldirty)) {
+		cw->seldirty = t->dirtynext;
+		t->dirtynext = 0;
+		cx = t->f0->cx;
+// leave seldirty set while we rebuild, eb$bso would only put it back on the list
+		if (t->jslink) {
 // there should always be an options array, if not then move on
-	cx = t->f0->cx;
-		oa = get_property_object(cx, *((JSValue*)t->jv), "options");
-		if(JS_IsUndefined(oa))
-			continue;
-		if ((len = get_arraylength(cx, oa)) < 0)
-			continue;
-		rebuildSelector(t, oa, len);
-		JS_Release(cx, oa);
+			oa = get_property_object_a(cx, *((JSValue*)t->jv), pa[PA_options]);
+			if (!JS_IsUndefined(oa)) {
+				if ((len = get_arraylength(cx, oa)) >= 0)
+					rebuildSelector(t, oa, len);
+				JS_Release(cx, oa);
+			}
+		}
+		t->seldirty = false;
 	}
 }
 
 // Some primitives needed by css.c. These bounce through window.soj$
-static const char soj[] = "soj$";
-static void sofail() { debugPrint(3, "no style object"); }
+static JSValue sojObject(JSContext *cx)
+{
+	JSValue j = get_property_object_a(cx, *(JSValue*)cf->winobj, pa[PA_soj]);
+	if(JS_IsUndefined(j))
+		debugPrint(3, "no style object");
+	return j;
+}
 
 bool has_gcs(const char *name)
 {
 	JSContext * cx = cf->cx;
 	bool l;
-	JSValue g = *(JSValue*)cf->winobj, j;
-	j = get_property_object(cx,  g, soj);
+	JSValue j = sojObject(cx);
 	if(JS_IsUndefined(j)) {
-		sofail();
 		return false;
 	}
 	        l = has_property(cx, j, name);
@@ -4346,10 +4648,8 @@ enum ej_proptype typeof_gcs(const char *name)
 {
 	enum ej_proptype l;
 	JSContext * cx = cf->cx;
-	JSValue g = *(JSValue*)cf->winobj, j;
-	j = get_property_object(cx,  g, soj);
+	JSValue j = sojObject(cx);
 	if(JS_IsUndefined(j)) {
-		sofail();
 		return EJ_PROP_NONE;
 	}
 	        l = typeof_property(cx, j, name);
@@ -4361,10 +4661,8 @@ int get_gcs_number(const char *name)
 {
 	JSContext * cx = cf->cx;
 	int l = -1;
-	JSValue g = *(JSValue*)cf->winobj, j;
-	j = get_property_object(cx,  g, soj);
+	JSValue j = sojObject(cx);
 	if(JS_IsUndefined(j)) {
-		sofail();
 		return -1;
 	}
 		l = get_property_number(cx, j, name);
@@ -4375,10 +4673,8 @@ int get_gcs_number(const char *name)
 void set_gcs_number(const char *name, int n)
 {
 	JSContext * cx = cf->cx;
-	JSValue g = *(JSValue*)cf->winobj, j;
-	j = get_property_object(cx,  g, soj);
+	JSValue j = sojObject(cx);
 	if(JS_IsUndefined(j)) {
-		sofail();
 		return;
 	}
 	set_property_number(cx, j, name, n);
@@ -4388,10 +4684,8 @@ void set_gcs_number(const char *name, int n)
 void set_gcs_bool(const char *name, bool v)
 {
 	JSContext * cx = cf->cx;
-	JSValue g = *(JSValue*)cf->winobj, j;
-	j = get_property_object(cx,  g, soj);
+	JSValue j = sojObject(cx);
 	if(JS_IsUndefined(j)) {
-		sofail();
 		return;
 	}
 	set_property_bool(cx, j, name, v);
@@ -4401,10 +4695,8 @@ void set_gcs_bool(const char *name, bool v)
 void set_gcs_string(const char *name, const char *s)
 {
 	JSContext * cx = cf->cx;
-	JSValue g = *(JSValue*)cf->winobj, j;
-	j = get_property_object(cx,  g, soj);
+	JSValue j = sojObject(cx);
 	if(JS_IsUndefined(j)) {
-		sofail();
 		return;
 	}
 	set_property_string(cx, j, name, s);
@@ -4414,6 +4706,7 @@ void set_gcs_string(const char *name, const char *s)
 void jsClose(void)
 {
 	if(js_running) {
+		freeAtoms();
 		JS_FreeContext(mwc);
 		grabover();
 // release the timer for pending jobs
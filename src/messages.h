@@ -860,4 +860,9 @@ MSG_ImaskOn,
 	MSG_False,
 	MSG_RemovingBOM,
 	MSG_RestoringBOM,
+	MSG_AccountMessages,
+	MSG_AccountFailed,
+	MSG_IdleOn,
+	MSG_IdleOff,
+	MSG_IdleLost,
 };
@@ -0,0 +1,400 @@
+/*********************************************************************
+reformcheck: run htmlReformat over a corpus of rendered pages,
+and over some random pages, and check the text after each group of passes,
+and the formatted page, against the sums in reformat/sums.
+htmlReformat hands us that text through reformatHook.
+usage: reformcheck [-w] [file.rf ...]
+Without files, it reads the .rf files in the directory reformat.
+-w writes reformat/sums instead of checking it.
+Only do that with a format.c whose output you trust,
+and say why in the commit.
+A .rf file is a page as render hands it to htmlReformat.
+edbrowse writes one when $EB_RFDUMP names a file, see renderDump() in html.c.
+Lines beginning with # are comments, then a line per tag that appears
+in the text: tag number name para, with the table type after a td,
+or a / after the closing pre. Then the word text on a line by itself,
+and the rest of the file is the text, with \2 \3 \4 \r \f written out
+as backslash escapes, and \\ for a backslash.
+Each page is also timed, so you can see what a change to format.c buys.
+*********************************************************************/
+
+#include "eb.h"
+
+#include <dirent.h>
+#include <time.h>
+
+// stubs needed by other edbrowse functions that we are pulling in.
+int context; // edbrowse context, not js
+struct ebWindow *cw;
+struct ebSession sessionList[3], *cs;
+int maxSession = 3;
+volatile bool intFlag;
+bool inInput;
+bool cxCompare(int cx) { return false; }
+bool cxActive(int cx, bool error) { return false; }
+bool cxQuit(int cx, int action) { return true; }
+void cxSwitch(int cx, bool interactive) {}
+bool browseCurrentBuffer(const char *suffix, bool present) { return false; }
+int sideBuffer(int cx, const char *text, int textlen, const char *bufname){ return 0; }
+void undoSpecialClear(void){}
+pst fetchLine(int n, int show){ return (uchar*)emptyString; }
+void delText(int start, int end) {}
+void addToMap(int nlines, int destl){}
+bool addTextToBuffer(const uchar *inbuf, int length, int destl, bool showtrail) { return true; }
+void printDot(void){}
+void eeCheck(void){}
+void ebClose(int n) { exit(n); }
+struct MACCOUNT accounts[MAXACCOUNT];
+int maxAccount;		/* how many email accounts specified */
+char *emojiFile;
+bool isDataURI(const char *u){ return false; }
+void unpercentString(char *s) {}
+
+// A tag that isn't listed in the .rf file is a span, it doesn't matter.
+static const struct tagInfo rcSpan = {"span", "a span", TAGACT_SPAN, 0, 0};
+
+static uchar *rcTableType;
+
+int tableType(const Tag *t)
+{
+	return rcTableType[t->seqno];
+}
+
+void preFormatCheck(int tagno, bool * pretag, bool * slash)
+{
+	const Tag *t;
+	*pretag = *slash = false;
+	if (tagno >= 0 && tagno < cw->numTags) {
+		t = tagList[tagno];
+		*pretag = (t->action == TAGACT_PRE);
+		*slash = t->slash;
+	}
+}
+
+// A fresh tag list of n tags, spans unless we are told otherwise.
+static void rcTags(int n)
+{
+	int j;
+	if (cw->tags) {
+		for (j = 0; j < cw->numTags; ++j) {
+			if (cw->tags[j]->info != &rcSpan)
+				nzFree((void *)cw->tags[j]->info);
+			nzFree(cw->tags[j]);
+		}
+		nzFree(cw->tags);
+		nzFree(rcTableType);
+	}
+	cw->tags = allocZeroMem(n * sizeof(Tag *));
+	rcTableType = allocZeroMem(n);
+	cw->numTags = n;
+	for (j = 0; j < n; ++j) {
+		Tag *t = allocZeroMem(sizeof(Tag));
+		t->seqno = j;
+		t->info = &rcSpan;
+		t->action = TAGACT_SPAN;
+		cw->tags[j] = t;
+	}
+}
+
+// Tag n, with its name and para, and the rest of the line from the .rf file,
+// a table type if it is a cell, or a / for the closing pre.
+static void rcTag(int n, const char *name, int para, const char *rest)
+{
+	struct tagInfo *ti = allocZeroMem(sizeof(struct tagInfo));
+	Tag *t = cw->tags[n];
+	strncpy((char *)ti->name, name, MAXTAGNAME - 1);
+	ti->desc = ti->name;
+	ti->para = para;
+	ti->action = TAGACT_SPAN;
+	if (stringEqual(name, "pre"))
+		ti->action = TAGACT_PRE;
+	if (*rest == '/')
+		t->slash = true;
+	if (isdigitByte(*rest)) {
+		ti->action = TAGACT_TD;
+		rcTableType[n] = *rest - '0';
+	}
+	t->info = ti;
+	t->action = ti->action;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int failures;
+static bool writing;
+
+/*********************************************************************
+The sums of the text after each pass, for a page or a block of random pages.
+Pass 1 is the cells, the transliteration, and the header whitespace,
+2 is anchorSwap, 3 is the unframing and the whitespace,
+and 4 is the formatted page.
+*********************************************************************/
+
+#define PASSES 4
+static unsigned long long sums[PASSES];
+
+static void rcHook(int pass, const char *buf)
+{
+	unsigned long long h = hashBytes(buf, strlen(buf));
+	if (pass < 1 || pass > PASSES)
+		return;
+	sums[pass - 1] = sums[pass - 1] * 0x100000001b3ULL ^ h;
+}
+
+// reformat/sums, as read, and as we write it
+static char *sumfile, *newsums;
+static int newsums_l;
+
+static void rcSums(const char *what)
+{
+	char line[200], *s;
+	int j, l;
+	sprintf(line, "%s", what);
+	for (j = 0; j < PASSES; ++j)
+		sprintf(line + strlen(line), " %016llx", sums[j]);
+	strcat(line, "\n");
+	memset(sums, 0, sizeof(sums));
+	if (writing) {
+		stringAndString(&newsums, &newsums_l, line);
+		return;
+	}
+// find what in the file and compare
+	l = strlen(what);
+	for (s = sumfile; *s; ++s) {
+		if (!strncmp(s, what, l) && s[l] == ' ')
+			break;
+		if (!(s = strchr(s, '\n')))
+			break;
+	}
+	if (!s || !*s) {
+		printf("%s: not in reformat/sums\n", what);
+		++failures;
+		return;
+	}
+	if (strncmp(s, line, strlen(line))) {
+		for (j = 0; j < PASSES; ++j)
+			if (strncmp(s + l + 1 + j * 17, line + l + 1 + j * 17, 16))
+				break;
+		printf("%s: pass %d differs\n", what, j + 1);
+		++failures;
+	}
+}
+
+static void rcRun(const char *page)
+{
+	int l = strlen(page);
+	char *b = allocMem(l + 1);
+	memcpy(b, page, l + 1);
+	nzFree(htmlReformat(b));
+	nzFree(b);
+}
+
+#define ROUNDS 20
+
+static void rcFile(const char *file)
+{
+	char *data, *s, *e, *page, *name;
+	int len, n, maxtag = 0, j;
+	double t;
+
+	if (!fileIntoMemory(file, &data, &len, 0)) {
+		printf("%s: cannot read\n", file);
+		++failures;
+		return;
+	}
+
+// find the highest tag number, then build the list
+	for (s = data; (s = strstr(s, "\\2")); s += 2) {
+		n = atoi(s + 2);
+		if (n > maxtag)
+			maxtag = n;
+	}
+	rcTags(maxtag + 1);
+
+	for (s = data; ; s = e + 1) {
+		char name2[MAXTAGNAME];
+		int k, para, used;
+		e = strchr(s, '\n');
+		if (!e) {
+			printf("%s: no text\n", file);
+			++failures;
+			nzFree(data);
+			return;
+		}
+		if (!strncmp(s, "text\n", 5))
+			break;
+		if (*s == '#' || strncmp(s, "tag ", 4))
+			continue;
+		if (sscanf(s + 4, "%d %19s %d%n", &k, name2, &para, &used) != 3 ||
+		    k < 0 || k > maxtag)
+			continue;
+		s += 4 + used;
+		if (*s == ' ')
+			++s;
+		rcTag(k, name2, para, s);
+	}
+
+// undo the escapes
+	page = allocMem(strlen(e + 1) + 1);
+	for (s = e + 1, j = 0; *s; ++s) {
+		char c = *s;
+		if (c == '\\' && s[1]) {
+			switch (*++s) {
+			case '2': c = InternalCodeChar; break;
+			case '3': c = TableCellChar; break;
+			case '4': c = DataCellChar; break;
+			case 'r': c = '\r'; break;
+			case 'f': c = '\f'; break;
+			case '\\': c = '\\'; break;
+			default: c = '\\', --s;
+			}
+		}
+		page[j++] = c;
+	}
+	page[j] = 0;
+	nzFree(data);
+
+	name = strrchr(file, '/');
+	name = name ? name + 1 : (char *)file;
+	reformatHook = rcHook;
+	rcRun(page);
+	reformatHook = 0;
+	rcSums(name);
+	t = now();
+	for (j = 0; j < ROUNDS; ++j)
+		rcRun(page);
+	printf("%-16s %9.3f ms\n", name, (now() - t) / ROUNDS);
+	nzFree(page);
+}
+
+// our own generator, so the random pages are the same everywhere
+static unsigned rcSeed = 17;
+static int rcRand(void)
+{
+	rcSeed = rcSeed * 1103515245 + 12345;
+	return (rcSeed >> 16) & 0x7fff;
+}
+
+// A random page out of the pieces these passes care about.
+// No }, anchorUnframe would take it as the close of a frame
+// whose open is the { on the end of an anchor, and break that tag.
+static char *rcRandom(int ntags)
+{
+	static const char *const bits[] = {
+		" ", "  ", "\n", "\r", "\f", "|", "\t", "x", "word", "é",
+		"[", "]", "{", "\f`` ", "\fh2 ", "\xc2\xa0", "\xe2\x80\x99",
+		"\xc2\xad", "\x93", "\xee\x80\x80", "(", "h2",
+	};
+	char *p;
+	int l, j, n = rcRand() % 200;
+	p = initString(&l);
+	for (j = 0; j < n; ++j) {
+		int r = rcRand() % 32;
+		if (r < 22) {
+			stringAndString(&p, &l, bits[r]);
+		} else if (r < 24) {
+			stringAndChar(&p, &l, (r & 1 ? TableCellChar : DataCellChar));
+		} else {
+			char tag[20];
+			sprintf(tag, "%c%d%c", InternalCodeChar, rcRand() % ntags, "{}<>*"[r % 5]);
+			stringAndString(&p, &l, tag);
+		}
+	}
+	return p;
+}
+
+static int rcCompare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+#define RANDOM 20000
+#define BLOCK 1000
+
+int main(int argc, char **argv)
+{
+	int j, l;
+	static const char *const names[] = {
+		"span", "a", "td", "td", "pre", "pre", "button", "p", "input", "br",
+	};
+	static const char paras[] = { 0, 0, 0, 0, 10, 10, 0, 10, 0, 1, };
+
+	selectLanguage();
+	cw = allocZeroMem(sizeof(Window));
+	if (argc > 1 && stringEqual(argv[1], "-w"))
+		writing = true, --argc, ++argv;
+	if (writing)
+		newsums = initString(&newsums_l);
+	else if (!fileIntoMemory("reformat/sums", &sumfile, &l, 0)) {
+		puts("cannot read reformat/sums");
+		return 1;
+	}
+
+	if (argc > 1) {
+		for (j = 1; j < argc; ++j)
+			rcFile(argv[j]);
+	} else {
+		DIR *d = opendir("reformat");
+		struct dirent *de;
+		char **files = 0;
+		int n = 0;
+		if (!d) {
+			puts("usage: reformcheck [-w] [file.rf ...]");
+			return 1;
+		}
+		while ((de = readdir(d))) {
+			char *f;
+			l = strlen(de->d_name);
+			if (l < 4 || !stringEqual(de->d_name + l - 3, ".rf"))
+				continue;
+			f = allocMem(l + 10);
+			sprintf(f, "reformat/%s", de->d_name);
+			files = (n ? reallocMem(files, (n + 1) * sizeof(char *)) :
+				 allocMem(sizeof(char *)));
+			files[n++] = f;
+		}
+		closedir(d);
+// the same order every time, so -w writes the same file
+		qsort(files, n, sizeof(char *), rcCompare);
+		for (j = 0; j < n; ++j)
+			rcFile(files[j]), nzFree(files[j]);
+		nzFree(files);
+	}
+
+// random pages over a small tag list, with pre sections and data cells
+	rcTags(40);
+	for (j = 0; j < 40; ++j)
+		rcTag(j, names[j % 10], paras[j % 10],
+		      (j % 10 == 2 ? "0" : j % 10 == 3 ? "1" : j % 10 == 5 ? "/" : ""));
+	reformatHook = rcHook;
+	for (j = 0; j < RANDOM; ++j) {
+		char *p = rcRandom(40);
+		rcRun(p);
+		nzFree(p);
+		if ((j + 1) % BLOCK == 0) {
+			char what[20];
+			sprintf(what, "random%d", j / BLOCK);
+			rcSums(what);
+		}
+	}
+	reformatHook = 0;
+
+	if (writing) {
+		if (!memoryOutToFile("reformat/sums", newsums, newsums_l)) {
+			showError();
+			return 1;
+		}
+		puts("reformat/sums written");
+		return 0;
+	}
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		puts("all the same");
+	return failures ? 2 : 0;
+}
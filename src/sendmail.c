@@ -16,6 +16,8 @@
 #define MAXMSLINE 1024		// max mail server line
 #define LONGLINELIMIT 76
 #define LONGWORDLIMIT 998
+#define MAILSTREAM (64*1024)	// attachments this big are encoded as they are sent
+#define MAILBLOCK (54*1024)	// bytes of such an attachment encoded at a time
 
 static char serverLine[MAXMSLINE];
 static bool doSignature;
@@ -265,6 +267,17 @@ const char *reverseAlias(const char *reply)
 	return 0;		/* not found */
 }
 
+// append =XX, the qp form of a byte
+static void qpByte(char **s, int *l, uchar c)
+{
+	static const char hexdigits[] = "0123456789ABCDEF";
+	char expand[3];
+	expand[0] = '=';
+	expand[1] = hexdigits[c >> 4];
+	expand[2] = hexdigits[c & 15];
+	stringAndBytes(s, l, expand, 3);
+}
+
 static char *qpEncode(const char *line)
 {
 	char *newbuf;
@@ -274,9 +287,7 @@ static char *qpEncode(const char *line)
 	newbuf = initString(&l);
 	for (s = line; (c = *s); ++s) {
 		if ((signed char)c < '\n' || c == '=' || c == '_' || c == '?') {
-			char expand[4];
-			sprintf(expand, "=%02X", (uchar) c);
-			stringAndString(&newbuf, &l, expand);
+			qpByte(&newbuf, &l, c);
 		} else {
 			if(c == ' ') c = '_';
 			stringAndChar(&newbuf, &l, c);
@@ -354,7 +365,9 @@ static char *charsetString(const char *ct, const char *ce)
  * If ismail is nonzero, the file is the mail, not an attachment.
  * In fact ismail indicates the line that holds the subject.
  * If ismail is negative, then -ismail indicates the subject line,
- * and the string file is not the filename, but rather, the mail to send. */
+ * and the string file is not the filename, but rather, the mail to send.
+ * A large file attachment bound for base64 is not encoded here;
+ * the data comes back null, and sendMail encodes it from the file as it goes. */
 bool
 encodeAttachment(const char *file, int ismail, bool webform,
 		 const char **type_p, const char **enc_p, char **data_p,
@@ -367,6 +380,7 @@ bool *long_p)
 	char *ct, *ce;		// content type, content encoding
 	int buflen, i, cx;
 	int nacount, nullcount, linelength, wordlength;
+	bool fromfile = false;
 
 	debugPrint(5, "subject at line %d", ismail);
 	if (ismail < 0) {
@@ -398,6 +412,7 @@ empty:
 		} else {
 			if (!fileIntoMemory(file, &buf, &buflen, 0))
 				return false;
+			fromfile = true;
 			if (!buflen) {
 				if (webform)
 					goto empty;
@@ -590,10 +605,18 @@ empty:
 // format=flowed.
 
 	if ((!ismail && (cr || !flow)) || nullcount || looksBinary((uchar*)buf, buflen)) {
+		ce = "base64";
+		if (fromfile && !ismail && !webform && buflen >= MAILSTREAM) {
+			nzFree(buf);
+			debugPrint(5, "encoded %s %s as it is sent", ct, ce);
+			*enc_p = ce;
+			*type_p = ct;
+			*data_p = 0;
+			return true;
+		}
 		s = base64Encode(buf, buflen, true);
 		nzFree(buf);
 		buf = s;
-		ce = "base64";
 		goto success;
 	}
 
@@ -642,9 +665,7 @@ empty:
 		    (uchar)c == 0xff ||
 		    ((c == ' ' || c == '\t') &&
 		     s < v - 1 && (s[1] == '\n' || s[1] == '\r'))))) {
-			char expand[4];
-			sprintf(expand, "=%02X", (uchar) c);
-			stringAndString(&newbuf, &l, expand);
+			qpByte(&newbuf, &l, c);
 			colno += 3;
 		} else if (!ismail && startlinedot && c == '.' && s != buf && s[-1] == '\n') {
 // In an attachment, add an extra dot at the start of a line (other than the first line).
@@ -815,33 +836,129 @@ char *makeBoundary(void)
 	return boundary;
 }
 
+/*********************************************************************
+The outgoing message is a chain of parts, and smtp_upload_callback
+pulls from the chain as curl wants more.
+Headers, boundaries, the body, and small attachments are text in memory.
+A large attachment that goes out in base64 is only a filename here;
+it is read and encoded a block at a time when the upload gets to it,
+so it is never in memory whole, let alone in two or three copies.
+A block is a multiple of 54 bytes, a full line of base64,
+so the lines come out just as they would from encoding the whole file.
+*********************************************************************/
+
+struct MAILPART {
+	struct MAILPART *next, *prev;
+	char *text;		// the text, or the current block of the file, encoded
+	int len, pos;
+	char *file;		// encode this file as we go
+	int fd;
+};
+
 struct smtp_upload {
-	const char *data;
-/* These really need to be size_t, not int!
- * fixme when edbrowse uses size_t consistently */
-	int length;
-	int pos;
+	struct listHead *parts;
+	struct MAILPART *cur;
+	bool failed;		// could not read an attachment
 };
 
+// The text built so far becomes a part, and the string starts over.
+static void mailPartText(struct listHead *parts, char **out, int *l)
+{
+	struct MAILPART *p;
+	if (!*l)
+		return;
+	p = allocZeroMem(sizeof(struct MAILPART));
+	p->text = *out, p->len = *l;
+	p->fd = -1;
+	addToListBack(parts, p);
+	*out = initString(l);
+}
+
+static void mailPartFile(struct listHead *parts, const char *file)
+{
+	struct MAILPART *p = allocZeroMem(sizeof(struct MAILPART));
+	p->file = cloneString(file);
+	p->fd = -1;
+	addToListBack(parts, p);
+}
+
+static void mailPartsFree(struct listHead *parts)
+{
+	struct MAILPART *p;
+	while (!listIsEmpty(parts)) {
+		p = parts->next;
+		delFromList(p);
+		if (p->fd >= 0)
+			close(p->fd);
+		nzFree(p->text);
+		nzFree(p->file);
+		free(p);
+	}
+}
+
+// Encode the next block of a file part; false at end of file or on error.
+static bool mailPartBlock(struct smtp_upload *upload, struct MAILPART *p)
+{
+	char *block;
+	int n, k;
+
+	nzFree(p->text), p->text = 0;
+	p->len = p->pos = 0;
+	if (p->fd < 0) {
+		p->fd = open(p->file, O_RDONLY | O_BINARY);
+		if (p->fd < 0)
+			goto fail;
+	}
+	block = allocMem(MAILBLOCK);
+	for (n = 0; n < MAILBLOCK; n += k) {
+		k = read(p->fd, block + n, MAILBLOCK - n);
+		if (k < 0) {
+			nzFree(block);
+			goto fail;
+		}
+		if (!k)
+			break;
+	}
+	if (n) {
+		p->text = base64Encode(block, n, true);
+		p->len = strlen(p->text);
+	}
+	nzFree(block);
+	if (n < MAILBLOCK)
+		close(p->fd), p->fd = -2;	// the last block
+	return n > 0;
+
+fail:
+	debugPrint(1, "cannot read attachment %s", p->file);
+	upload->failed = true;
+	return false;
+}
+
 static size_t smtp_upload_callback(char *buffer_for_curl, size_t size,
 				   size_t nmem, struct smtp_upload *upload)
 {
 	size_t out_buffer_size = size * nmem;
-	size_t remaining = upload->length - upload->pos;
-	size_t to_send, cur_pos;
+	size_t sent = 0, to_send;
+	struct MAILPART *p;
 
-	if (upload->pos >= upload->length)
-		return 0;
-
-	if (out_buffer_size < remaining)
-		to_send = out_buffer_size;
-	else
-		to_send = remaining;
-
-	memcpy(buffer_for_curl, upload->data + upload->pos, to_send);
-	cur_pos = upload->pos + to_send;
-	upload->pos = cur_pos;
-	return to_send;
+	while (sent < out_buffer_size &&
+	       (p = upload->cur) != (struct MAILPART *)upload->parts) {
+		if (p->pos == p->len) {
+			if (p->file && p->fd != -2 && mailPartBlock(upload, p))
+				continue;
+			if (upload->failed)
+				return CURL_READFUNC_ABORT;
+			upload->cur = p->next;
+			continue;
+		}
+		to_send = p->len - p->pos;
+		if (to_send > out_buffer_size - sent)
+			to_send = out_buffer_size - sent;
+		memcpy(buffer_for_curl + sent, p->text + p->pos, to_send);
+		p->pos += to_send;
+		sent += to_send;
+	}
+	return sent;
 }
 
 static char *buildSMTPURL(const struct MACCOUNT *account)
@@ -960,25 +1077,21 @@ new_handle_cleanup:
 	return handle;
 }
 
-typedef struct tagsmtp_upload {
-	const char *data;
-	size_t length;
-	size_t pos;
-} smtp_upload;
-
 static bool
 sendMailSMTP(const struct MACCOUNT *account, const char *reply,
-	     const char **recipients, const char *message)
+	     const char **recipients, struct listHead *parts)
 {
 	CURL *handle = 0;
 	CURLcode res = CURLE_OK;
 	bool smtp_success = false;
 	char *smtp_url = buildSMTPURL(account);
 	struct curl_slist *recipient_slist = buildRecipientSList(recipients);
-	smtp_upload upload;
-	upload.data = message;
-	upload.length = strlen(message);
-	upload.pos = 0;
+	struct smtp_upload upload;
+	struct MAILPART *p;
+
+	upload.parts = parts;
+	upload.cur = parts->next;
+	upload.failed = false;
 	handle = newSendmailHandle(account, smtp_url, reply, recipient_slist);
 
 	if (!handle)
@@ -990,7 +1103,12 @@ sendMailSMTP(const struct MACCOUNT *account, const char *reply,
 
 	if(debugLevel >= 6) {
 		debugPrint(6, "outgoing message");
-		debugPrint(6, "%s", message);
+		foreach(p, *parts) {
+			if (p->file)
+				debugPrint(6, "<%s in base64>", p->file);
+			else
+				debugPrint(6, "%s", p->text);
+		}
 		puts("debug don't send");
 	} else {
 		cerror[0] = 0;
@@ -1027,6 +1145,7 @@ sendMail(int account, const char **recipients, const char *body,
 	bool firstrec, flowed;
 	const char *ct, *ce;
 	char *encoded = 0;
+	struct listHead parts;
 
 	if (!validAccount(account))
 		return false;
@@ -1150,7 +1269,8 @@ sendMail(int account, const char **recipients, const char *body,
 
 	boundary = makeBoundary();
 
-// Build the outgoing mail as one string.
+// Build the outgoing mail as a chain of parts, see struct MAILPART.
+	initList(&parts);
 	out = initString(&j);
 
 	firstrec = true;
@@ -1251,7 +1371,7 @@ this format, some or all of this message may not be legible.\r\n\r\n--");
 	if (mustmime) {
 		for (i = 0; (s = attachments[i]); ++i) {
 			if (!encodeAttachment(s, 0, false, &ct, &ce, &encoded, 0))
-				return false;
+				goto done;
 			sprintf(serverLine, "%s--%s%sContent-Type: %s%s", eol,
 				boundary, eol, ct, charsetString(ct, ce));
 			stringAndString(&out, &j, serverLine);
@@ -1284,6 +1404,11 @@ this format, some or all of this message may not be legible.\r\n\r\n--");
 				"%sContent-Transfer-Encoding: %s%s%s", eol, ce,
 				eol, eol);
 			stringAndString(&out, &j, serverLine);
+			if (!encoded) {
+				mailPartText(&parts, &out, &j);
+				mailPartFile(&parts, s);
+				continue;
+			}
 			appendAttachment(encoded, &out, &j, false, ct);
 			nzFree(encoded);
 			encoded = 0;
@@ -1296,8 +1421,11 @@ this format, some or all of this message may not be legible.\r\n\r\n--");
 
 	/* mime format */
 
-	sendmail_success = sendMailSMTP(ao, reply, recipients, out);
+	mailPartText(&parts, &out, &j);
+	sendmail_success = sendMailSMTP(ao, reply, recipients, &parts);
+done:
 	nzFree(out);
+	mailPartsFree(&parts);
 	return sendmail_success;
 }
 
@@ -2546,33 +2546,27 @@ this.form.reset();
 }
 }
 if(t != "checkbox" && t != "radio") return;
-this.checked$2 = (this.checked$2 ? false : true);
-// if it's radio and checked we need to uncheck the others.
-if(this.form && this.checked$2 && t == "radio" &&
-(nn = this.name) && (e = this.form[nn]) && Array.isArray(e)) {
-for(var i=0; i<e.length; ++i)
-if(e[i] != this) e[i].checked$2 = false;
-} else // try it another way
-if(this.checked$2 && t == "radio" && this.parentNode && (e = this.parentNode.childNodes) && (nn = this.name)) {
-for(var i=0; i<e.length; ++i)
-if(e[i].nodeName == "INPUT" && e[i].type == t && e[i].name == nn &&e[i] != this) e[i].checked$2 = false;
-}
+checkset.call(this, this.checked$2 ? false : true);
 }
 }
 
+// Every box that changes is passed to eb$fieldchange,
+// so jSyncup knows edbrowse's copy of checked is stale.
 function checkset(n) {
 if(typeof n !== "boolean") n = false;
+var w = my$win();
+if(this.checked$2 !== n) w.eb$fieldchange(this);
 this.checked$2 = n;
 var nn = this.nodeName, t = this.type, e;
 // if it's radio and checked we need to uncheck the others.
 if(this.form && this.checked$2 && t == "radio" &&
 (nn = this.name) && (e = this.form[nn]) && Array.isArray(e)) {
 for(var i=0; i<e.length; ++i)
-if(e[i] != this) e[i].checked$2 = false;
+if(e[i] != this && e[i].checked$2) e[i].checked$2 = false, w.eb$fieldchange(e[i]);
 } else // try it another way
 if(this.checked$2 && t == "radio" && this.parentNode && (e = this.parentNode.childNodes) && (nn = this.name)) {
 for(var i=0; i<e.length; ++i)
-if(e[i].nodeName == "INPUT" && e[i].type == t && e[i].name == nn &&e[i] != this) e[i].checked$2 = false;
+if(e[i].nodeName == "INPUT" && e[i].type == t && e[i].name == nn &&e[i] != this && e[i].checked$2) e[i].checked$2 = false, w.eb$fieldchange(e[i]);
 }
 }
 
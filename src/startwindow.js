@@ -790,6 +790,7 @@ set:function(v) { this.setAttribute("required", v);}});
 
 HTMLSelectElement.prototype.eb$bso = function() { // build selected options array
 // do not replace the array with a new one, this is suppose to be a live array
+eb$fieldchange(this);
 var a = this.selectedOptions;
 var o = this.options;
 a.length = o.length = 0;
@@ -1682,10 +1683,26 @@ this.value = arguments[1];
 })
 spdc("HTMLOptionElement", HTMLElement)
 swm2("Option", HTMLOptionElement)
-Option.prototype.selected = false;
 Option.prototype.defaultSelected = false;
 Option.prototype.nodeName = Option.prototype.tagName = "OPTION";
-Option.prototype.text = Option.prototype.value = "";
+// selected text and value are accessors, so that changing one tells
+// edbrowse which select to recheck, see rebuildSelectors.
+Option.prototype.selected$2 = false;
+Option.prototype.text$2 = Option.prototype.value$2 = "";
+Option.prototype.eb$touch = function() {
+var p = this.parentNode;
+if(p && p.nodeName == "OPTGROUP") p = p.parentNode;
+if(p && (p.nodeName == "SELECT" || p.nodeName == "DATALIST")) eb$fieldchange(p);
+}
+Object.defineProperty(Option.prototype, "selected", {
+get: function() { return this.selected$2; },
+set: function(v) { if(this.selected$2 !== v) this.selected$2 = v, this.eb$touch(); }});
+Object.defineProperty(Option.prototype, "text", {
+get: function() { return this.text$2; },
+set: function(v) { if(this.text$2 !== v) this.text$2 = v, this.eb$touch(); }});
+Object.defineProperty(Option.prototype, "value", {
+get: function() { return this.value$2; },
+set: function(v) { if(this.value$2 !== v) this.value$2 = v, this.eb$touch(); }});
 
 swm("HTMLOptGroupElement", function() {})
 spdc("HTMLOptGroupElement", HTMLElement)
@@ -36,8 +36,28 @@ Allocate and manage memory.
 Allocate and copy strings.
 If we're out of memory, the program aborts.  No error legs.
 Soooooo much easier! With 32gb of RAM, we shouldn't run out.
+allocCount counts the calls, for the profiler; see prof.
+It doesn't see what quickjs or curl allocate on their own.
+The background threads allocate too, so the count is atomic.
 *********************************************************************/
 
+static long long allocCount;
+#ifdef _MSC_VER
+#include <intrin.h>
+#define allocCounted() _InterlockedIncrement64(&allocCount)
+#else
+#define allocCounted() __atomic_add_fetch(&allocCount, 1, __ATOMIC_RELAXED)
+#endif
+
+long long allocTotal(void)
+{
+#ifdef _MSC_VER
+	return _InterlockedOr64(&allocCount, 0);
+#else
+	return __atomic_load_n(&allocCount, __ATOMIC_RELAXED);
+#endif
+}
+
 void *allocMem(size_t n)
 {
 	void *s;
@@ -45,6 +65,7 @@ void *allocMem(size_t n)
 		return emptyString;
 	if (!(s = malloc(n)))
 		i_printfExit(MSG_MemAllocError, n);
+	allocCounted();
 	return s;
 }
 
@@ -55,6 +76,7 @@ void *allocZeroMem(size_t n)
 		return emptyString;
 	if (!(s = calloc(n, 1)))
 		i_printfExit(MSG_MemCallocError, n);
+	allocCounted();
 	return s;
 }
 
@@ -74,6 +96,7 @@ void *reallocMem(void *p, size_t n)
 	}
 	if (!(s = realloc(p, n)))
 		i_printfExit(MSG_ErrorRealloc, n);
+	allocCounted();
 	return s;
 }
 
@@ -393,6 +416,17 @@ bool stringIsFloat(const char *s, double *dp)
 	return true;
 }
 
+// fnv-1a, good enough to tell one file or script from another
+unsigned long long hashBytes(const char *s, int len)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	while (len-- > 0) {
+		h ^= (uchar) * s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
 bool memEqualCI(const char *s, const char *t, int len)
 {
 	char c, d;
@@ -0,0 +1,26 @@
+// a little of what a real settings page does on load and on submit
+var rows = [];
+for (var i = 0; i < 200; ++i)
+	rows.push({ n: i, name: "row " + i, on: (i % 3 == 0) });
+
+function check() {
+	var f = document.forms.settings;
+	if (!f.user.value) {
+		document.getElementById("status").textContent = "name is required";
+		return false;
+	}
+	return true;
+}
+
+document.addEventListener("DOMContentLoaded", function() {
+	var s = document.getElementById("status");
+	var ul = document.createElement("ul");
+	rows.forEach(function(r) {
+		if (!r.on) return;
+		var li = document.createElement("li");
+		li.textContent = r.name;
+		ul.appendChild(li);
+	});
+	s.appendChild(ul);
+	document.forms.settings.user.value = "guest";
+});